@@ -0,0 +1,6 @@
+# builds the benchmark on linux, needs g++ and the opencv development package
+cd "$(dirname "$0")"
+g++ -std=c++14 -O2 -march=native -pthread -o benchmark main.cpp \
+    ../sampler/harmonics.cpp ../sampler/cubemap.cpp ../sampler/basis_table.cpp \
+    ../sampler/panorama.cpp ../sampler/mapped_file.cpp ../sampler/tiled_cubemap.cpp \
+    $(pkg-config --cflags --libs opencv4 2>/dev/null || pkg-config --cflags --libs opencv)
@@ -0,0 +1,668 @@
+#include "../sampler/util.h"
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include "../sampler/basis.h"
+#include "../sampler/simd.h"
+#include "../sampler/batch.h"
+#include "../sampler/cubemap.h"
+#include "../sampler/harmonics.h"
+#include "../sampler/rotation.h"
+#include "../sampler/tiled_cubemap.h"
+#include "../sampler/philox.h"
+
+using namespace std;
+
+// prints one csv record per measurement:
+//   benchmark,variant,degree,size,threads,ns_per_item
+// degree or size is empty where it does not apply, size is the face width.
+// with --accuracy N it prints the round-off of the accumulation modes instead:
+//   mode,degree,samples,relative_error
+// and with --check it compares the texel geometry against double precision
+// references, exiting with the number of failed checks:
+//   check,size,error,result
+// where error is relative for weights and coefficients, and absolute in
+// color units otherwise
+// on linux build with build.sh next to this file
+
+struct Options
+{
+	int max_degree = 8;
+	int max_size = 1024;
+	int threads = 1;
+	string filter;
+	size_t accuracy_samples = 0;
+	bool check = false;
+};
+
+// random unit directions in SoA layout
+struct Directions
+{
+	Directions(int n)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			Vec3 p = Normalize({ NormalRandom(), NormalRandom(), NormalRandom() });
+			x.push_back(p.x);
+			y.push_back(p.y);
+			z.push_back(p.z);
+		}
+	}
+	size_t Size()const { return x.size(); }
+	Vec3 operator[](size_t i)const { return Vec3(x[i], y[i], z[i]); }
+	vector<float> x, y, z;
+};
+
+// smooth sky gradient with a small bright sun, so no image files are needed
+Cubemap SyntheticCubemap(int size)
+{
+	array<cv::Mat, 6> faces;
+	for (int k = 0; k < 6; k++)
+	{
+		faces[k] = cv::Mat(size, size, CV_32FC3);
+		for (int i = 0; i < size; i++)
+		{
+			cv::Vec3f* row = faces[k].ptr<cv::Vec3f>(i);
+			for (int j = 0; j < size; j++)
+			{
+				Vec3 p = Normalize(CubeUV2XYZ({ k, (j + 0.5f) / size, 1.f - (i + 0.5f) / size }));
+				float sky = 0.5f + 0.5f * p.y;
+				float sun = p.x * 0.6f + p.y * 0.8f > 0.99f ? 20.f : 0.f;
+				row[j] = cv::Vec3f(sky + sun, 0.6f * sky + sun, 0.3f + 0.2f * p.x + sun);
+			}
+		}
+	}
+	return Cubemap(faces);
+}
+
+// nanoseconds per item of f(), which handles count items
+template<typename F>
+double TimeNs(F f, size_t count)
+{
+	const double min_seconds = 0.2;
+	int reps = 0;
+	auto start = chrono::steady_clock::now();
+	double seconds = 0;
+	do {
+		f();
+		reps++;
+		seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	} while (seconds < min_seconds);
+	return seconds * 1e9 / ((double)reps * count);
+}
+
+float sink;
+
+void Record(const string& name, const string& variant, int degree, int size,
+	int threads, double ns)
+{
+	cout << name << "," << variant << ","
+		<< (degree >= 0 ? to_string(degree) : "") << ","
+		<< (size > 0 ? to_string(size) : "") << ","
+		<< threads << "," << ns << endl;
+}
+
+bool Enabled(const Options& opt, const string& name)
+{
+	return opt.filter.empty() || name.find(opt.filter) != string::npos;
+}
+
+vector<int> Degrees(const Options& opt)
+{
+	vector<int> degrees;
+	for (int d = 0; d <= min(opt.max_degree, Harmonics::MaxDegree); d++)
+		if (d <= 4 || d == 8 || d == Harmonics::MaxDegree)
+			degrees.push_back(d);
+	return degrees;
+}
+
+vector<int> Sizes(const Options& opt)
+{
+	vector<int> sizes;
+	for (int s = 64; s <= opt.max_size; s *= 4)
+		sizes.push_back(s);
+	return sizes;
+}
+
+template<typename B>
+double BasisScalarNs(const B& basis, const Directions& dirs)
+{
+	return TimeNs([&]() {
+		float Y[B::MaxN];
+		float s = 0;
+		for (size_t i = 0; i < dirs.Size(); i++)
+		{
+			basis.Eval(dirs[i], Y);
+			for (int k = 0; k < basis.Size(); k++)
+				s += Y[k];
+		}
+		sink += s;
+	}, dirs.Size());
+}
+
+template<typename B>
+double BasisPackNs(const B& basis, const Directions& dirs)
+{
+	return TimeNs([&]() {
+		Pack Y[B::MaxN];
+		Pack s;
+		for (size_t i = 0; i + Pack::Width <= dirs.Size(); i += Pack::Width)
+		{
+			basis.Eval(Pack::Load(&dirs.x[i]), Pack::Load(&dirs.y[i]), Pack::Load(&dirs.z[i]), Y);
+			for (int k = 0; k < basis.Size(); k++)
+				s = s + Y[k];
+		}
+		sink += ReduceAdd(s);
+	}, dirs.Size() / Pack::Width * Pack::Width);
+}
+
+template<typename B>
+void BenchFixedBasis(int degree, const B& fixed, const Directions& dirs)
+{
+	Record("basis", "fixed", degree, 0, 1, BasisScalarNs(fixed, dirs));
+	Record("basis", string("fixed-") + Pack::Name(), degree, 0, 1, BasisPackNs(fixed, dirs));
+}
+
+// SHBasis and SHRecurrence directly, and Harmonics::Basis on top of them
+void BenchBasis(const Options& opt, const Directions& dirs)
+{
+	for (int degree : Degrees(opt))
+	{
+		SHRecurrence recurrence(degree);
+		Record("basis", "recurrence", degree, 0, 1, BasisScalarNs(recurrence, dirs));
+		Record("basis", string("recurrence-") + Pack::Name(), degree, 0, 1, BasisPackNs(recurrence, dirs));
+		switch (degree)
+		{
+		case 0: BenchFixedBasis(0, SHBasis<0>(), dirs); break;
+		case 1: BenchFixedBasis(1, SHBasis<1>(), dirs); break;
+		case 2: BenchFixedBasis(2, SHBasis<2>(), dirs); break;
+		case 3: BenchFixedBasis(3, SHBasis<3>(), dirs); break;
+		}
+
+		Harmonics harmonics(degree);
+		Record("harmonics_basis", "", degree, 0, 1, TimeNs([&]() {
+			float Y[SHRecurrence::MaxN];
+			float s = 0;
+			for (size_t i = 0; i < dirs.Size(); i++)
+			{
+				harmonics.Basis(dirs[i], Y);
+				s += Y[harmonics.CoefficientNum() - 1];
+			}
+			sink += s;
+		}, dirs.Size()));
+	}
+}
+
+// building the band matrices per rotation, applying them per coefficient set
+void BenchRotate(const Options& opt)
+{
+	float r[9];
+	Vec3 axis = Normalize({ 0.3f, -0.7f, 0.5f });
+	float c = cos(1.1f), s = sin(1.1f);
+	float k[3] = { axis.x, axis.y, axis.z };
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			r[3 * i + j] = k[i] * k[j] * (1 - c) + (i == j ? c : 0);
+	r[1] -= axis.z * s; r[2] += axis.y * s;
+	r[3] += axis.z * s; r[5] -= axis.x * s;
+	r[6] -= axis.y * s; r[7] += axis.x * s;
+
+	const size_t sets = 1024;
+	for (int degree : Degrees(opt))
+	{
+		Record("rotate", "build", degree, 0, 1, TimeNs([&]() {
+			sink += SHRotation(degree, r)(degree, 0, 0);
+		}, 1));
+		SHRotation rotation(degree, r);
+		size_t n = 3 * (degree + 1)*(degree + 1) * sets;
+		vector<float> in(n, 1.f), out(n);
+		Record("rotate", "apply", degree, 0, 1, TimeNs([&]() {
+			rotation.Apply(in.data(), out.data(), sets);
+			sink += out[0];
+		}, sets));
+	}
+}
+
+void BenchXYZ2CubeUV(const Directions& dirs)
+{
+	Record("xyz2cubeuv", "", -1, 0, 1, TimeNs([&]() {
+		float s = 0;
+		for (size_t i = 0; i < dirs.Size(); i++)
+		{
+			CubeUV c = XYZ2CubeUV(dirs[i]);
+			s += c.u + c.v + c.index;
+		}
+		sink += s;
+	}, dirs.Size()));
+}
+
+// lookups per face size
+void BenchSample(const Options& opt, const Cubemap& cubemap, const Directions& dirs)
+{
+	int size = cubemap.Width();
+	if (Enabled(opt, "cubemap_sample"))
+	{
+		Record("cubemap_sample", "vec3", -1, size, 1, TimeNs([&]() {
+			float s = 0;
+			for (size_t i = 0; i < dirs.Size(); i++)
+				s += cubemap.Sample(dirs[i]).r;
+			sink += s;
+		}, dirs.Size()));
+
+		SampleBatch batch;
+		batch.Resize(dirs.Size());
+		batch.x = dirs.x;
+		batch.y = dirs.y;
+		batch.z = dirs.z;
+		Record("cubemap_sample", "batch", -1, size, 1, TimeNs([&]() {
+			cubemap.Sample(batch);
+			sink += batch.r[0];
+		}, dirs.Size()));
+		for (auto storage : { Cubemap::Storage::PlanarByte, Cubemap::Storage::PlanarHalf })
+		{
+			Cubemap planar = cubemap.Convert(storage);
+			Record("cubemap_sample", storage == Cubemap::Storage::PlanarByte ? "batch-planar8" : "batch-half",
+				-1, size, 1, TimeNs([&]() {
+				planar.Sample(batch);
+				sink += batch.r[0];
+			}, dirs.Size()));
+		}
+	}
+	if (Enabled(opt, "random_sample"))
+	{
+		const int n = 1 << 16;
+		Record("random_sample", "", -1, size, 1, TimeNs([&]() {
+			sink += cubemap.RandomSample(n)[0].color.r;
+		}, n));
+	}
+}
+
+// projection per sample or texel
+void BenchEvaluate(const Options& opt, const Cubemap& cubemap, const Directions& dirs, bool with_samples)
+{
+	int size = cubemap.Width();
+	SampleBatch batch;
+	batch.Resize(dirs.Size());
+	batch.x = dirs.x;
+	batch.y = dirs.y;
+	batch.z = dirs.z;
+	cubemap.Sample(batch);
+	auto vertices = batch.Vertices();
+	for (int degree : Degrees(opt))
+	{
+		Harmonics harmonics(degree);
+		if (with_samples && Enabled(opt, "evaluate"))
+		{
+			Record("evaluate", "scalar", degree, 0, opt.threads, TimeNs([&]() {
+				harmonics.Evaluate(vertices, opt.threads);
+			}, vertices.size()));
+			Record("evaluate", Pack::Name(), degree, 0, opt.threads, TimeNs([&]() {
+				harmonics.Evaluate(batch, opt.threads);
+			}, batch.Size()));
+		}
+		if (with_samples && Enabled(opt, "evaluate_stream"))
+		{
+			// same chunks in both modes, so only the merging differs
+			for (bool precise : { false, true })
+			{
+				harmonics.SetPrecise(precise);
+				Record("evaluate_stream", precise ? "precise" : "float", degree, 0, opt.threads, TimeNs([&]() {
+					harmonics.Evaluate([&](size_t first, size_t n, SampleBatch& samples) {
+						samples.Resize(n);
+						for (auto a : { &SampleBatch::x, &SampleBatch::y, &SampleBatch::z, &SampleBatch::r, &SampleBatch::g, &SampleBatch::b })
+							copy((batch.*a).begin() + first, (batch.*a).begin() + first + n, (samples.*a).begin());
+					}, batch.Size(), opt.threads, Harmonics::PreciseLeaf);
+				}, batch.Size()));
+			}
+			harmonics.SetPrecise(false);
+		}
+		if (Enabled(opt, "integrate"))
+		{
+			Record("integrate", "texel", degree, size, opt.threads, TimeNs([&]() {
+				harmonics.Integrate(cubemap, opt.threads);
+			}, cubemap.TexelNum()));
+		}
+	}
+}
+
+// round-off against sample count. the stream cycles through one set of
+// samples, so every multiple of the set size has the coefficients of the set
+// itself, summed here in double; what remains is accumulation error only
+void BenchAccuracy(const Options& opt, const Cubemap& cubemap)
+{
+	const size_t set_size = 4096;
+	Directions dirs(set_size);
+	SampleBatch set;
+	set.Resize(set_size);
+	set.x = dirs.x;
+	set.y = dirs.y;
+	set.z = dirs.z;
+	cubemap.Sample(set);
+
+	int degree = min(opt.max_degree, Harmonics::MaxDegree);
+	Harmonics harmonics(degree);
+	int n = harmonics.CoefficientNum();
+	vector<double> expected(3 * n);
+	for (size_t i = 0; i < set_size; i++)
+	{
+		float Y[SHRecurrence::MaxN];
+		harmonics.Basis(dirs[i], Y);
+		for (int k = 0; k < n; k++)
+		{
+			expected[3 * k] += (double)Y[k] * set.r[i];
+			expected[3 * k + 1] += (double)Y[k] * set.g[i];
+			expected[3 * k + 2] += (double)Y[k] * set.b[i];
+		}
+	}
+	for (double& e : expected)
+		e *= 4 * M_PI / set_size;
+	double dc = max({ abs(expected[0]), abs(expected[1]), abs(expected[2]) });
+
+	cout << "mode,degree,samples,relative_error" << endl;
+	for (size_t samples = set_size; samples <= opt.accuracy_samples; samples *= 10)
+	{
+		for (bool precise : { false, true })
+		{
+			harmonics.SetPrecise(precise);
+			harmonics.Evaluate([&](size_t first, size_t count, SampleBatch& batch) {
+				batch.Resize(count);
+				for (size_t i = 0; i < count; i++)
+				{
+					size_t j = (first + i) % set_size;
+					batch.x[i] = set.x[j]; batch.y[i] = set.y[j]; batch.z[i] = set.z[j];
+					batch.r[i] = set.r[j]; batch.g[i] = set.g[j]; batch.b[i] = set.b[j];
+				}
+			}, samples, opt.threads);
+			auto coefs = harmonics.getCoefficients();
+			double error = 0;
+			for (int k = 0; k < n; k++)
+			{
+				double d[3] = { coefs[k].r - expected[3 * k], coefs[k].g - expected[3 * k + 1], coefs[k].b - expected[3 * k + 2] };
+				error += d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+			}
+			cout << (precise ? "precise" : "float") << "," << degree << "," << samples << ","
+				<< sqrt(error / (3 * n)) / dc << endl;
+		}
+	}
+}
+
+struct DVec
+{
+	double x, y, z;
+};
+
+DVec operator-(DVec a, DVec b) { return{ a.x - b.x, a.y - b.y, a.z - b.z }; }
+double Dot(DVec a, DVec b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+DVec Cross(DVec a, DVec b) { return{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+// solid angle of triangle a, b, c seen from the origin (Van Oosterom and
+// Strackee); the edges are taken from a so small triangles keep precision
+double TriangleSolidAngle(DVec a, DVec b, DVec c)
+{
+	double num = abs(Dot(a, Cross(b - a, c - a)));
+	double la = sqrt(Dot(a, a)), lb = sqrt(Dot(b, b)), lc = sqrt(Dot(c, c));
+	double den = la * lb * lc + Dot(a, b) * lc + Dot(a, c) * lb + Dot(b, c) * la;
+	return 2 * atan2(num, den);
+}
+
+// solid angle of texel (i, j) of a size x size face as two triangles, a
+// reference independent of Cubemap::TexelGeometry
+double TexelSolidAngle(int size, int i, int j)
+{
+	double s0 = 2.0 * j / size - 1, s1 = 2.0 * (j + 1) / size - 1;
+	double t0 = 1 - 2.0 * i / size, t1 = 1 - 2.0 * (i + 1) / size;
+	DVec a{ s0, t0, 1 }, b{ s1, t0, 1 }, c{ s1, t1, 1 }, d{ s0, t1, 1 };
+	return TriangleSolidAngle(a, b, c) + TriangleSolidAngle(a, c, d);
+}
+
+bool Report(const string& check, int size, double error, double tolerance)
+{
+	bool ok = error <= tolerance;
+	cout << check << "," << size << "," << error << "," << (ok ? "ok" : "FAILED") << endl;
+	return ok;
+}
+
+// every texel weight against the reference, and the six faces against 4 pi
+int CheckTexelGeometry(int size)
+{
+	SampleBatch row;
+	double total = 0, max_error = 0;
+	for (int i = 0; i < size; i++)
+	{
+		Cubemap::TexelGeometry(size, size, 0, i, row);
+		for (int j = 0; j < size; j++)
+		{
+			double expected = TexelSolidAngle(size, i, j);
+			max_error = max(max_error, abs(row.r[j] - expected) / expected);
+			total += row.r[j];
+		}
+	}
+	int failed = 0;
+	failed += !Report("texel_weight", size, max_error, 1e-6);
+	failed += !Report("texel_weight_sum", size, abs(6 * total - 4 * M_PI) / (4 * M_PI), 1e-6);
+	return failed;
+}
+
+// 8-bit faces with detail down to the texel, so wrong weights show
+array<cv::Mat, 6> TexturedFaces(int size)
+{
+	array<cv::Mat, 6> faces;
+	for (int k = 0; k < 6; k++)
+	{
+		faces[k] = cv::Mat(size, size, CV_8UC3);
+		for (int i = 0; i < size; i++)
+		{
+			cv::Vec3b* row = faces[k].ptr<cv::Vec3b>(i);
+			for (int j = 0; j < size; j++)
+			{
+				Vec3 p = Normalize(CubeUV2XYZ({ k, (j + 0.5f) / size, 1.f - (i + 0.5f) / size }));
+				for (int c = 0; c < 3; c++)
+					row[j][c] = (unsigned char)(127.5f + 127.f * sin(97.f * p.x + 61.f * p.y * (c + 1) + 29.f * p.z) * ((i + j + c) % 3 ? 1.f : 0.5f));
+			}
+		}
+	}
+	return faces;
+}
+
+// a 2:1 reduction against the solid angle weighted mean of the children
+int CheckDownsample(int size)
+{
+	array<cv::Mat, 6> faces = TexturedFaces(size);
+	Cubemap reduced = Cubemap(faces).Downsample();
+	double max_error = 0;
+	for (int k = 0; k < 6; k++)
+	{
+		vector<float> rgb[3];
+		for (auto& c : rgb)
+			c.resize(size / 2);
+		for (int i = 0; i < size / 2; i++)
+		{
+			reduced.RowColors(k, i, rgb[0].data(), rgb[1].data(), rgb[2].data());
+			for (int j = 0; j < size / 2; j++)
+			{
+				double sum[3] = { 0, 0, 0 }, total = 0;
+				for (int a = 2 * i; a < 2 * i + 2; a++)
+				{
+					for (int b = 2 * j; b < 2 * j + 2; b++)
+					{
+						double w = TexelSolidAngle(size, a, b);
+						const cv::Vec3b& texel = faces[k].ptr<cv::Vec3b>(a)[b];
+						total += w;
+						// faces are bgr, samples rgb
+						for (int c = 0; c < 3; c++)
+							sum[c] += w * texel[2 - c] / 255.0;
+					}
+				}
+				for (int c = 0; c < 3; c++)
+					max_error = max(max_error, abs(rgb[c][j] - sum[c] / total));
+			}
+		}
+	}
+	return !Report("downsample", size, max_error, 1e-5);
+}
+
+// out-of-core against resident integration of the same binary ppm faces,
+// and both DC coefficients against a double sum over the texels
+int CheckTiled(int size)
+{
+	array<cv::Mat, 6> faces = TexturedFaces(size);
+	array<string, 6> files;
+	double dc[3] = { 0, 0, 0 };
+	for (int k = 0; k < 6; k++)
+	{
+		files[k] = "check_tiled_" + to_string(k) + ".ppm";
+		ofstream out(files[k], ios::binary);
+		out << "P6\n" << size << " " << size << "\n255\n";
+		vector<unsigned char> rgb(3 * size);
+		for (int i = 0; i < size; i++)
+		{
+			const cv::Vec3b* row = faces[k].ptr<cv::Vec3b>(i);
+			for (int j = 0; j < size; j++)
+			{
+				double w = TexelSolidAngle(size, i, j);
+				for (int c = 0; c < 3; c++)
+				{
+					rgb[3 * j + c] = row[j][2 - c];
+					dc[c] += w * row[j][2 - c] / 255.0;
+				}
+			}
+			out.write((const char*)rgb.data(), rgb.size());
+		}
+	}
+	for (double& c : dc)
+		c *= 0.5 * sqrt(1 / M_PI);
+
+	const int degree = 4;
+	Harmonics resident(degree), tiled(degree);
+	resident.Integrate(Cubemap(faces));
+	{
+		TiledCubemap cubemap(files, 16 << 20);
+		tiled.Integrate(cubemap);
+	}
+	for (const string& file : files)
+		remove(file.c_str());
+
+	auto a = resident.getCoefficients();
+	auto b = tiled.getCoefficients();
+	double scale = max({ dc[0], dc[1], dc[2] });
+	double agreement = 0, reference = 0;
+	for (size_t k = 0; k < a.size(); k++)
+		agreement = max({ agreement, (double)abs(a[k].r - b[k].r), (double)abs(a[k].g - b[k].g), (double)abs(a[k].b - b[k].b) });
+	for (const Vec3& c : { a[0], b[0] })
+		reference = max({ reference, abs(c.r - dc[0]), abs(c.g - dc[1]), abs(c.b - dc[2]) });
+	int failed = 0;
+	failed += !Report("tiled_vs_resident", size, agreement / scale, 1e-5);
+	failed += !Report("tiled_dc", size, reference / scale, 1e-5);
+	return failed;
+}
+
+// known answer of Philox4x32-10 for counter 0 and key 0 (Random123 kat_vectors),
+// the error is the number of differing words
+int CheckPhilox()
+{
+	const Philox::Block expected = { 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u };
+	Philox::Block block = Philox(0)(0);
+	int wrong = 0;
+	for (int i = 0; i < 4; i++)
+		wrong += block[i] != expected[i];
+	return !Report("philox_known_answer", 0, wrong, 0);
+}
+
+int RunChecks()
+{
+	cout << "check,size,error,result" << endl;
+	int failed = 0;
+	failed += CheckPhilox();
+	failed += CheckTexelGeometry(4096);
+	failed += CheckDownsample(2048);
+	failed += CheckTiled(4096);
+	return failed;
+}
+
+// reconstruction per direction or texel
+void BenchRender(const Options& opt, const Cubemap& cubemap, const Directions& dirs, bool with_directions)
+{
+	int size = cubemap.Width();
+	for (int degree : Degrees(opt))
+	{
+		Harmonics harmonics(degree);
+		harmonics.Integrate(cubemap, opt.threads);
+		if (with_directions && Enabled(opt, "render"))
+		{
+			Record("render", "", degree, 0, 1, TimeNs([&]() {
+				float s = 0;
+				for (size_t i = 0; i < dirs.Size(); i++)
+					s += harmonics.Render(dirs[i]).r;
+				sink += s;
+			}, dirs.Size()));
+		}
+		if (Enabled(opt, "render_cubemap"))
+		{
+			for (bool simd : { false, true })
+			{
+				Record("render_cubemap", simd ? Pack::Name() : "scalar", degree, size, opt.threads, TimeNs([&]() {
+					sink += harmonics.RenderCubemap(size, size, simd, opt.threads)[0].at<cv::Vec3f>(0, 0)[0];
+				}, cubemap.TexelNum()));
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--max-degree" && i + 1 < argc)
+			opt.max_degree = stoi(argv[++i]);
+		else if (arg == "--max-size" && i + 1 < argc)
+			opt.max_size = stoi(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc)
+			opt.threads = max(1, stoi(argv[++i]));
+		else if (arg == "--filter" && i + 1 < argc)
+			opt.filter = argv[++i];
+		else if (arg == "--accuracy" && i + 1 < argc)
+			opt.accuracy_samples = stoull(argv[++i]);
+		else if (arg == "--check")
+			opt.check = true;
+		else
+		{
+			cerr << "Usage: ./benchmark [--max-degree D] [--max-size N] [--threads N] [--filter NAME]" << endl
+				<< "       ./benchmark --accuracy SAMPLES [--max-degree D] [--threads N]" << endl
+				<< "       ./benchmark --check" << endl
+				<< "  face sizes run from 64 to N by factors of 4, N = 4096 needs about 2 GB" << endl;
+			return 1;
+		}
+	}
+
+	if (opt.check)
+		return RunChecks();
+	if (opt.accuracy_samples > 0)
+	{
+		BenchAccuracy(opt, SyntheticCubemap(64));
+		return 0;
+	}
+
+	cout << "benchmark,variant,degree,size,threads,ns_per_item" << endl;
+	Directions dirs(1 << 16);
+	if (Enabled(opt, "basis"))
+		BenchBasis(opt, dirs);
+	if (Enabled(opt, "rotate"))
+		BenchRotate(opt);
+	if (Enabled(opt, "xyz2cubeuv"))
+		BenchXYZ2CubeUV(dirs);
+	vector<int> sizes = Sizes(opt);
+	for (size_t i = 0; i < sizes.size(); i++)
+	{
+		Cubemap cubemap = SyntheticCubemap(sizes[i]);
+		BenchSample(opt, cubemap, dirs);
+		BenchEvaluate(opt, cubemap, dirs, i == 0);
+		BenchRender(opt, cubemap, dirs, i == 0);
+	}
+	return sink == 1234.5f ? 2 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+degree=3
+samplenum=1000000
+for f in data/*
+do 
+    if [ -d "$f" ]; then
+        echo "===== convergence of $f ====="
+        Release/sampler.exe $f jpg $degree $samplenum --convergence
+    fi
+done
\ No newline at end of file
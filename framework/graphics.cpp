@@ -199,11 +199,11 @@ void Model::ProcNode(aiNode* node, const aiScene* scene)
 	}
 }
 
-Mesh Model::ProcMesh(aiMesh* mesh, const aiScene* scene)
+// vertices and triangle indices of mesh, without gl objects
+static MeshData ReadMeshData(aiMesh* mesh)
 {
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
-	vector<Texture> textures;
 
 	// process vertices
 	for (GLuint i = 0; i < mesh->mNumVertices; i++)
@@ -233,6 +233,34 @@ Mesh Model::ProcMesh(aiMesh* mesh, const aiScene* scene)
 		for (GLuint j = 0; j < face.mNumIndices; j++)
 			indices.push_back(face.mIndices[j]);
 	}
+	return{ vertices, indices };
+}
+
+static void ReadNodeData(aiNode* node, const aiScene* scene, vector<MeshData>& meshes)
+{
+	for (GLuint i = 0; i < node->mNumMeshes; i++)
+		meshes.push_back(ReadMeshData(scene->mMeshes[node->mMeshes[i]]));
+	for (GLuint i = 0; i < node->mNumChildren; i++)
+		ReadNodeData(node->mChildren[i], scene, meshes);
+}
+
+vector<MeshData> fw::LoadMeshData(string filename)
+{
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_FlipUVs);
+	if (!scene || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode){
+		throw runtime_error(string("Loading model error:") + importer.GetErrorString());
+	}
+	vector<MeshData> meshes;
+	ReadNodeData(scene->mRootNode, scene, meshes);
+	return meshes;
+}
+
+Mesh Model::ProcMesh(aiMesh* mesh, const aiScene* scene)
+{
+	MeshData data = ReadMeshData(mesh);
+	vector<Texture> textures;
+
 	// process material
 	if (mesh->mMaterialIndex >= 0)
 	{
@@ -245,7 +273,7 @@ Mesh Model::ProcMesh(aiMesh* mesh, const aiScene* scene)
 		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
 	}
 
-	return Mesh(vertices, indices, textures);
+	return Mesh(data.vertices_, data.indices_, textures);
 }
 
 vector<Texture> Model::LoadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
@@ -35,6 +35,13 @@ namespace fw{
 		aiString path_;
 	};
 
+	/** vertices and triangle indices of a mesh without gl objects, for drawing on the cpu
+	*/
+	struct MeshData{
+		vector<Vertex> vertices_;
+		vector<GLuint> indices_;
+	};
+
 	class Mesh{
 	public:
 		Mesh(const vector<Vertex>& vertices,
@@ -87,6 +94,10 @@ namespace fw{
 	*/
 	shared_ptr<Model> LoadModel(string filename);
 
+	/** load the meshes of a model from file, needs no gl context
+	*/
+	vector<MeshData> LoadMeshData(string filename);
+
 	/** load shaders & attach to a new program, note you have to delete program manually
 	*/
 	GLuint CreateProgram(vector<tuple<string, GLenum>> shader_src);
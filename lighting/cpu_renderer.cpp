@@ -0,0 +1,258 @@
+#include <cmath>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+#include "cpu_renderer.h"
+
+using namespace std;
+
+namespace
+{
+	// f(begin, end, t) over thread_num contiguous ranges in order
+	template<class F>
+	void ParallelFor(size_t count, int thread_num, F f)
+	{
+		vector<thread> threads;
+		for (int t = 0; t < thread_num; t++)
+			threads.emplace_back(f, count * t / thread_num, count * (t + 1) / thread_num, t);
+		for (thread& t : threads)
+			t.join();
+	}
+
+	// sh_fragment_src on the cpu, the normal is used as interpolated
+	glm::vec3 ShadeSH(glm::vec3 n, const glm::vec3* coef, int sh_num)
+	{
+		const float PI = 3.1415926535897932384626433832795f;
+		float basis[16];
+		float x = n.x;
+		float y = n.y;
+		float z = n.z;
+		float x2 = x*x;
+		float y2 = y*y;
+		float z2 = z*z;
+
+		basis[0] = 1.f / 2.f * sqrt(1.f / PI);
+		basis[1] = sqrt(3.f / (4.f*PI))*z;
+		basis[2] = sqrt(3.f / (4.f*PI))*y;
+		basis[3] = sqrt(3.f / (4.f*PI))*x;
+		basis[4] = 1.f / 2.f * sqrt(15.f / PI) * x * z;
+		basis[5] = 1.f / 2.f * sqrt(15.f / PI) * z * y;
+		basis[6] = 1.f / 4.f * sqrt(5.f / PI) * (-x*x - z*z + 2 * y*y);
+		basis[7] = 1.f / 2.f * sqrt(15.f / PI) * y * x;
+		basis[8] = 1.f / 4.f * sqrt(15.f / PI) * (x*x - z*z);
+		basis[9] = 1.f / 4.f*sqrt(35.f / (2.f*PI))*(3 * x2 - z2)*z;
+		basis[10] = 1.f / 2.f*sqrt(105.f / PI)*x*z*y;
+		basis[11] = 1.f / 4.f*sqrt(21.f / (2.f*PI))*z*(4 * y2 - x2 - z2);
+		basis[12] = 1.f / 4.f*sqrt(7.f / PI)*y*(2 * y2 - 3 * x2 - 3 * z2);
+		basis[13] = 1.f / 4.f*sqrt(21.f / (2.f*PI))*x*(4 * y2 - x2 - z2);
+		basis[14] = 1.f / 4.f*sqrt(105.f / PI)*(x2 - z2)*y;
+		basis[15] = 1.f / 4.f*sqrt(35.f / (2 * PI))*(x2 - 3 * z2)*x;
+
+		glm::vec3 c(0.f);
+		for (int i = 0; i < sh_num; i++)
+			c += coef[i] * basis[i];
+		return c;
+	}
+}
+
+CpuRenderer::Triangle::Triangle(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c)
+{
+	area = ((double)b.x - a.x)*((double)c.y - a.y) - ((double)b.y - a.y)*((double)c.x - a.x);
+	v[0] = &a;
+	v[1] = area < 0 ? &c : &b;
+	v[2] = area < 0 ? &b : &c;
+	area = abs(area);
+	for (int k = 0; k < 3; k++)
+	{
+		const ScreenVertex& from = *v[(k + 1) % 3];
+		const ScreenVertex& to = *v[(k + 2) % 3];
+		dx[k] = (double)to.x - from.x;
+		dy[k] = (double)to.y - from.y;
+		// pixel centers on an edge belong to the triangle on its top or left
+		top_left[k] = dy[k] < 0 || (dy[k] == 0 && dx[k] > 0);
+	}
+}
+
+CpuRenderer::CpuRenderer(int width, int height, int thread_num)
+	:width_(width), height_(height), thread_num_(max(1, thread_num)),
+	tiles_x_((width + TileSize - 1) / TileSize), tiles_y_((height + TileSize - 1) / TileSize),
+	color_((size_t)width * height), depth_((size_t)width * height, 1.f)
+{
+	if (width <= 0 || height <= 0)
+		throw invalid_argument("frame size must be positive");
+	bins_.resize(thread_num_, vector<vector<uint32_t>>(tiles_x_ * tiles_y_));
+}
+
+void CpuRenderer::Clear(glm::vec3 color)
+{
+	fill(color_.begin(), color_.end(), color);
+	fill(depth_.begin(), depth_.end(), 1.f);
+}
+
+void CpuRenderer::Draw(const std::vector<fw::MeshData>& meshes, glm::mat4 model_view_proj,
+	glm::mat4 normal_trans, const std::vector<glm::vec3>& coefs, int degree)
+{
+	// all meshes as one vertex and index list
+	vector<size_t> first_vertex;
+	size_t vertex_num = 0;
+	size_t index_num = 0;
+	for (const fw::MeshData& mesh : meshes)
+		index_num += mesh.indices_.size() / 3 * 3;
+	indices_.clear();
+	indices_.reserve(index_num);
+	for (const fw::MeshData& mesh : meshes)
+	{
+		first_vertex.push_back(vertex_num);
+		size_t full = mesh.indices_.size() / 3 * 3;
+		for (size_t i = 0; i < full; i++)
+			indices_.push_back((GLuint)(mesh.indices_[i] + vertex_num));
+		vertex_num += mesh.vertices_.size();
+	}
+	vertices_.resize(vertex_num);
+
+	ParallelFor(vertex_num, thread_num_, [&](size_t begin, size_t end, int) {
+		size_t m = upper_bound(first_vertex.begin(), first_vertex.end(), begin) - first_vertex.begin() - 1;
+		for (size_t i = begin; i < end; i++)
+		{
+			while (m + 1 < meshes.size() && i >= first_vertex[m + 1])
+				m++;
+			const fw::Vertex& v = meshes[m].vertices_[i - first_vertex[m]];
+			glm::vec4 clip = model_view_proj * glm::vec4(v.position_, 1.f);
+			ScreenVertex& s = vertices_[i];
+			s.inv_w = clip.z >= -clip.w && clip.w > 0 ? 1.f / clip.w : 0.f;
+			s.x = round((clip.x * s.inv_w * 0.5f + 0.5f) * width_ * 256.f) / 256.f;
+			s.y = round((0.5f - clip.y * s.inv_w * 0.5f) * height_ * 256.f) / 256.f;
+			s.z = clip.z * s.inv_w * 0.5f + 0.5f;
+			s.normal = glm::normalize(glm::vec3(normal_trans * glm::vec4(v.normal_, 0.f)));
+		}
+	});
+
+	size_t triangle_num = indices_.size() / 3;
+	ParallelFor(triangle_num, thread_num_, [&](size_t begin, size_t end, int t) {
+		auto& bins = bins_[t];
+		for (auto& bin : bins)
+			bin.clear();
+		for (size_t i = begin; i < end; i++)
+		{
+			const ScreenVertex& a = vertices_[indices_[3 * i]];
+			const ScreenVertex& b = vertices_[indices_[3 * i + 1]];
+			const ScreenVertex& c = vertices_[indices_[3 * i + 2]];
+			if (a.inv_w == 0 || b.inv_w == 0 || c.inv_w == 0)
+				continue;
+			// range of pixel centers in the bounding box, clamped to the
+			// frame before rounding as off-screen vertices can be far out.
+			// most triangles of a dense mesh cover no pixel center and end here
+			float x0 = ceil(max(min({ a.x, b.x, c.x }) - 0.5f, 0.f));
+			float x1 = floor(min(max({ a.x, b.x, c.x }) - 0.5f, width_ - 1.f));
+			float y0 = ceil(max(min({ a.y, b.y, c.y }) - 0.5f, 0.f));
+			float y1 = floor(min(max({ a.y, b.y, c.y }) - 0.5f, height_ - 1.f));
+			if (x0 > x1 || y0 > y1 || !(Triangle(a, b, c).area > 0))
+				continue;
+			for (int ty = (int)y0 / TileSize; ty <= (int)y1 / TileSize; ty++)
+				for (int tx = (int)x0 / TileSize; tx <= (int)x1 / TileSize; tx++)
+					bins[ty * tiles_x_ + tx].push_back((uint32_t)i);
+		}
+	});
+
+	int sh_num = min((min(degree, 3) + 1)*(min(degree, 3) + 1), (int)coefs.size());
+	atomic<int> next(0);
+	ParallelFor(thread_num_, thread_num_, [&](size_t, size_t, int) {
+		for (int tile = next++; tile < tiles_x_ * tiles_y_; tile = next++)
+			RasterizeTile(tile, coefs.data(), sh_num);
+	});
+}
+
+void CpuRenderer::RasterizeTile(int tile, const glm::vec3* coefs, int sh_num)
+{
+	int left = tile % tiles_x_ * TileSize;
+	int top = tile / tiles_x_ * TileSize;
+	int right = min(left + TileSize, width_);
+	int bottom = min(top + TileSize, height_);
+
+	float depth[TileSize * TileSize];
+	uint32_t ids[TileSize * TileSize];
+	for (int y = top; y < bottom; y++)
+		for (int x = left; x < right; x++)
+		{
+			depth[(y - top) * TileSize + x - left] = depth_[(size_t)y * width_ + x];
+			ids[(y - top) * TileSize + x - left] = NoTriangle;
+		}
+
+	for (const auto& bins : bins_)
+	{
+		for (uint32_t id : bins[tile])
+		{
+			Triangle tri(vertices_[indices_[3 * id]], vertices_[indices_[3 * id + 1]], vertices_[indices_[3 * id + 2]]);
+			float x0 = max(min({ tri.v[0]->x, tri.v[1]->x, tri.v[2]->x }) - 0.5f, (float)left);
+			float x1 = min(max({ tri.v[0]->x, tri.v[1]->x, tri.v[2]->x }) - 0.5f, right - 1.f);
+			float y0 = max(min({ tri.v[0]->y, tri.v[1]->y, tri.v[2]->y }) - 0.5f, (float)top);
+			float y1 = min(max({ tri.v[0]->y, tri.v[1]->y, tri.v[2]->y }) - 0.5f, bottom - 1.f);
+			for (int y = (int)ceil(y0); y <= (int)floor(y1); y++)
+			{
+				for (int x = (int)ceil(x0); x <= (int)floor(x1); x++)
+				{
+					double w[3];
+					tri.Weights(x + 0.5, y + 0.5, w);
+					if (!tri.Inside(w))
+						continue;
+					// window depth is linear on screen
+					float z = (float)((w[0] * tri.v[0]->z + w[1] * tri.v[1]->z + w[2] * tri.v[2]->z) / tri.area);
+					float& d = depth[(y - top) * TileSize + x - left];
+					if (z < d)
+					{
+						d = z;
+						ids[(y - top) * TileSize + x - left] = id;
+					}
+				}
+			}
+		}
+	}
+
+	for (int y = top; y < bottom; y++)
+	{
+		for (int x = left; x < right; x++)
+		{
+			uint32_t id = ids[(y - top) * TileSize + x - left];
+			if (id == NoTriangle)
+				continue;
+			Triangle tri(vertices_[indices_[3 * id]], vertices_[indices_[3 * id + 1]], vertices_[indices_[3 * id + 2]]);
+			double w[3];
+			tri.Weights(x + 0.5, y + 0.5, w);
+			// perspective correct interpolation of the normal
+			glm::vec3 normal(0.f);
+			float sum = 0;
+			for (int k = 0; k < 3; k++)
+			{
+				float p = (float)(w[k] / tri.area) * tri.v[k]->inv_w;
+				sum += p;
+				normal += p * tri.v[k]->normal;
+			}
+			size_t pixel = (size_t)y * width_ + x;
+			color_[pixel] = ShadeSH(normal / sum, coefs, sh_num);
+			depth_[pixel] = depth[(y - top) * TileSize + x - left];
+		}
+	}
+}
+
+void CpuRenderer::Write(const std::string& filename)const
+{
+	vector<unsigned char> rgb(color_.size() * 3);
+	for (size_t i = 0; i < color_.size(); i++)
+		for (int c = 0; c < 3; c++)
+			rgb[3 * i + c] = (unsigned char)(min(max(color_[i][c], 0.f), 1.f) * 255.f + 0.5f);
+	string ext = filename.substr(filename.find_last_of('.') + 1);
+	int ok = 0;
+	if (ext == "png")
+		ok = stbi_write_png(filename.c_str(), width_, height_, 3, rgb.data(), width_ * 3);
+	else if (ext == "jpg")
+		ok = stbi_write_jpg(filename.c_str(), width_, height_, 3, rgb.data(), 95);
+	else if (ext == "bmp")
+		ok = stbi_write_bmp(filename.c_str(), width_, height_, 3, rgb.data());
+	else
+		throw invalid_argument("unknown image format " + ext);
+	if (!ok)
+		throw runtime_error("write " + filename + " failed");
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "../framework/graphics.h"
+
+// headless reference renderer of SH lit meshes. the frame is cut into
+// square tiles; all threads transform the vertices and bin the triangles
+// to the tiles they overlap, then each tile is rasterized by one thread into
+// a triangle id and depth buffer and shaded once per covered pixel with the
+// basis of sh_fragment_src, so overdraw costs no shading. triangles crossing
+// the near plane are dropped rather than clipped
+class CpuRenderer
+{
+public:
+	CpuRenderer(int width, int height, int thread_num);
+	int Width()const { return width_; }
+	int Height()const { return height_; }
+
+	void Clear(glm::vec3 color);
+	// depth tested against what is already drawn; as in Object::SetDegree
+	// degrees above 3 shade with degree 3
+	void Draw(const std::vector<fw::MeshData>& meshes, glm::mat4 model_view_proj, glm::mat4 normal_trans,
+		const std::vector<glm::vec3>& coefs, int degree);
+	// rgb rows from the top, unclamped
+	const std::vector<glm::vec3>& Pixels()const { return color_; }
+	// png, jpg or bmp by extension, clamped to 8 bits
+	void Write(const std::string& filename)const;
+private:
+	static const int TileSize = 64;
+	static const uint32_t NoTriangle = 0xffffffff;
+
+	// a transformed vertex, x and y in pixels from the top left snapped to
+	// 1/256 like gpus do and z the window depth; inv_w is 0 in front of the
+	// near plane
+	struct ScreenVertex
+	{
+		float x, y, z;
+		float inv_w;
+		glm::vec3 normal;
+	};
+
+	// edge functions of a triangle, its vertices ordered for a positive
+	// area. with snapped vertices they are exact in double, so neighbouring
+	// triangles neither leave gaps nor overlap
+	struct Triangle
+	{
+		const ScreenVertex* v[3];
+		double area;
+		// edge k runs from v[k+1] to v[k+2], its function is the
+		// barycentric weight of v[k] times area
+		double dx[3], dy[3];
+		bool top_left[3];
+
+		Triangle(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c);
+		void Weights(double x, double y, double w[3])const
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				const ScreenVertex& from = *v[(k + 1) % 3];
+				w[k] = dx[k] * (y - from.y) - dy[k] * (x - from.x);
+			}
+		}
+		bool Inside(const double w[3])const
+		{
+			for (int k = 0; k < 3; k++)
+				if (w[k] < 0 || (w[k] == 0 && !top_left[k]))
+					return false;
+			return true;
+		}
+	};
+
+	void RasterizeTile(int tile, const glm::vec3* coefs, int sh_num);
+
+	int width_;
+	int height_;
+	int thread_num_;
+	int tiles_x_;
+	int tiles_y_;
+	std::vector<glm::vec3> color_;
+	std::vector<float> depth_;
+
+	// kept between draws to reuse their storage
+	std::vector<ScreenVertex> vertices_;
+	std::vector<GLuint> indices_;
+	// triangle ids of every tile by the binning thread, so each tile sees
+	// the triangles in submission order
+	std::vector<std::vector<std::vector<uint32_t>>> bins_;
+};
\ No newline at end of file
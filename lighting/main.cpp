@@ -1,13 +1,29 @@
 #include <array>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <chrono>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "../framework/framework.h"
+#include "../sampler/coef_pack.h"
+#include "../sampler/rotation.h"
+#include "cpu_renderer.h"
 
 using namespace std;
 
+// initial camera of the window, also used by the headless renderer
+const glm::vec3 CameraPosition = { 3.f, 3.f, 3.f };
+const glm::vec3 CameraUp = { 0.f, 1.f, 0.f };
+const glm::vec3 ClearColor = { 0.5f, 0.5f, 0.5f };
+
+glm::mat4 Projection(float ratio)
+{
+	return glm::perspective(glm::radians(60.f), ratio, 0.1f, 100.f);
+}
+
 
 class Env
 {
@@ -26,7 +42,20 @@ public:
 			coefs_.push_back(glm::vec3(r, g, b));
 			i++;
 		}
+		rotated_ = coefs_;
+	}
 
+	// coefficients of entry name in a mapped coefficient pack
+	Env(array<string, 6> cubemap, const CoefPack& pack, const string& name)
+		:cubemap_(cubemap)
+	{
+		int index = pack.Find(name);
+		if (index < 0)
+			throw runtime_error(name + " not found in coefficient pack");
+		const float* rgb = pack.Coefficients(index);
+		for (uint32_t i = 0; i < pack.Entry(index).coefnum; i++)
+			coefs_.push_back(glm::vec3(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]));
+		rotated_ = coefs_;
 	}
 
 	void Init()
@@ -40,19 +69,38 @@ public:
 		delete skybox_;
 	}
 
+	// coefficients of the rotated environment
 	vector<glm::vec3> getCoefficients()const
 	{
-		return coefs_;
+		return rotated_;
+	}
+
+	// turns the environment about the up axis; the coefficients are rotated
+	// instead of sampled again, which takes microseconds
+	void Rotate(float angle)
+	{
+		rotation_ = glm::rotate(rotation_, angle, glm::vec3(0.f, 1.f, 0.f));
+		int degree = (int)round(sqrt((float)coefs_.size())) - 1;
+		if (degree < 0 || (size_t)(degree + 1)*(degree + 1) != coefs_.size())
+			return;
+		float r[9];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				r[3 * i + j] = rotation_[j][i];
+		SHRotation rotation(degree, r);
+		rotation.Apply((const float*)coefs_.data(), (float*)rotated_.data());
 	}
 
 	void Draw(glm::mat4 view, glm::mat4 proj)
 	{
-		skybox_->Draw(proj*view);
+		skybox_->Draw(proj*view*rotation_);
 	}
 private:
 	array<string, 6> cubemap_;
 	fw::SkyBox* skybox_;
 	vector<glm::vec3> coefs_;
+	vector<glm::vec3> rotated_;
+	glm::mat4 rotation_ = glm::mat4(1.f);
 };
 
 
@@ -205,6 +253,7 @@ public:
 	}
 
 	void SetDegree(int degree) { degree_ = degree; }
+	void RotateEnv(float angle) { envs_[current_env_]->Rotate(angle); }
 private:
 
 	vector< Env* > envs_;
@@ -243,6 +292,13 @@ private:
 				if (key == GLFW_KEY_3)
 					app_->SetDegree(3);
 			}
+			if (action == GLFW_PRESS || action == GLFW_REPEAT)
+			{
+				if (key == GLFW_KEY_LEFT)
+					app_->RotateEnv(glm::radians(-5.f));
+				if (key == GLFW_KEY_RIGHT)
+					app_->RotateEnv(glm::radians(5.f));
+			}
 
 		}
 	};
@@ -252,7 +308,7 @@ private:
 	void OnInit() override
 	{
 		// input proc
-		input_proc_ = new SHInput(this, { 3.f, 3.f, 3.f }, { 0.f, 1.f, 0.f });
+		input_proc_ = new SHInput(this, CameraPosition, CameraUp);
 		this->SetInputProcessor(input_proc_);
 
 		envs_[current_env_]->Init();
@@ -272,10 +328,10 @@ private:
 		glEnable(GL_DEPTH_TEST);
 
 		glm::mat4 view = input_proc_->GetCameraView();
-		glm::mat4 proj = glm::perspective(glm::radians(60.f), FrameRatio(), 0.1f, 100.f);
+		glm::mat4 proj = Projection(FrameRatio());
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+		glClearColor(ClearColor.r, ClearColor.g, ClearColor.b, 1.0f);
 		envs_[current_env_]->Draw(view, proj);
 
 		// compute transforms
@@ -300,16 +356,80 @@ private:
 	}
 };
 
+// last component of path without its extension
+string FileStem(const string& path)
+{
+	string name = path.substr(path.find_last_of("/\\") + 1);
+	return name.substr(0, name.find_last_of('.'));
+}
+
+// renders every model under every environment on the cpu from the window's
+// initial camera, without the skybox, into outdir/<environment>_<model>.png
+void RenderHeadless(const vector<Env*>& envs, const vector<string>& env_names,
+	const vector<string>& models, const string& outdir, int width, int height, int threads, int degree)
+{
+	CpuRenderer renderer(width, height, threads);
+	glm::mat4 view = glm::lookAt(CameraPosition, glm::vec3(0.f), CameraUp);
+	glm::mat4 model_view_proj = Projection((float)width / height) * view;
+	glm::mat4 normal_trans(1.f);
+	for (const string& model : models)
+	{
+		vector<fw::MeshData> meshes = fw::LoadMeshData(model);
+		size_t triangles = 0;
+		for (const fw::MeshData& mesh : meshes)
+			triangles += mesh.indices_.size() / 3;
+		for (size_t i = 0; i < envs.size(); i++)
+		{
+			auto start = chrono::steady_clock::now();
+			renderer.Clear(ClearColor);
+			renderer.Draw(meshes, model_view_proj, normal_trans, envs[i]->getCoefficients(), degree);
+			double ms = chrono::duration<double>(chrono::steady_clock::now() - start).count() * 1000;
+			string outfile = outdir + env_names[i] + "_" + FileStem(model) + ".png";
+			renderer.Write(outfile);
+			cout << outfile << ": " << triangles << " triangles, " << ms << " ms" << endl;
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 
 	try {
 		if (argc < 5)
-			throw invalid_argument("Usage: ./lighting N directory1 format1 ... directoryN formatN M model1 ... modelM");
+			throw invalid_argument("Usage: ./lighting [--pack FILE] [--headless OUTDIR [--size WxH] [--threads N] [--degree D]] "
+				"N directory1 format1 ... directoryN formatN M model1 ... modelM");
 		int k = 1;
+		// environments are looked up by directory name in the pack instead
+		// of reading their coefficients.txt
+		unique_ptr<CoefPack> pack;
+		// rendered on the cpu into this directory instead of a window
+		string headless;
+		int width = 800, height = 600, degree = 3;
+		int threads = max(1, (int)thread::hardware_concurrency());
+		while (k + 1 < argc && string(argv[k]).compare(0, 2, "--") == 0)
+		{
+			string opt = argv[k], value = argv[k + 1];
+			if (opt == "--pack")
+				pack.reset(new CoefPack(value));
+			else if (opt == "--headless")
+				headless = value.back() == '/' || value.back() == '\\' ? value : value + '/';
+			else if (opt == "--size")
+			{
+				width = stoi(value);
+				height = stoi(value.substr(value.find('x') + 1));
+			}
+			else if (opt == "--threads")
+				threads = stoi(value);
+			else if (opt == "--degree")
+				degree = stoi(value);
+			else
+				throw invalid_argument("unknown option " + opt);
+			k += 2;
+		}
 		int N = stoi(argv[k++]);
 
 		vector< Env*> envs(N);
+		vector<string> env_names(N);
 		for(int i = 0; i < N; i++)
 		{
 			string dir = argv[k++];
@@ -321,19 +441,35 @@ int main(int argc, char *argv[])
 			array<string, 6> cube_textures;
 			for (int i = 0; i < 6; i++)
 				cube_textures[i] = dir + faces[i] + "." + format;
-			string sh_coef_file = dir + "coefficients.txt";
-			envs[i] = new Env(cube_textures, sh_coef_file);
+			string name = dir.substr(0, dir.size() - 1);
+			env_names[i] = name.substr(name.find_last_of("/\\") + 1);
+			if (pack)
+				envs[i] = new Env(cube_textures, *pack, env_names[i]);
+			else
+			{
+				string sh_coef_file = dir + "coefficients.txt";
+				envs[i] = new Env(cube_textures, sh_coef_file);
+			}
 		}
 
 		int M = stoi(argv[k++]);
 		vector< Object* > objs(M);
+		vector<string> models(M);
 		for (int i = 0; i < M; i++)
-			objs[i] = new Object(string(argv[k++]));
+		{
+			models[i] = argv[k++];
+			objs[i] = new Object(models[i]);
+		}
 
-		SHLightingApp app(envs, objs);
-		app.SetWindowSize(800, 600);
-		app.SetWindowTitle("Spherical Harmonics Lighting");
-		app.Run();
+		if (!headless.empty())
+			RenderHeadless(envs, env_names, models, headless, width, height, threads, degree);
+		else
+		{
+			SHLightingApp app(envs, objs);
+			app.SetWindowSize(width, height);
+			app.SetWindowTitle("Spherical Harmonics Lighting");
+			app.Run();
+		}
 		for (auto e : envs)
 			delete e;
 		for (auto o : objs)
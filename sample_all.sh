@@ -5,7 +5,6 @@ write_rendered=
 for f in data/*
 do 
     if [ -d "$f" ]; then
-        echo "===== processing $f ====="
-        Release/sampler.exe $f jpg $degree $samplenum $write_rendered
+        echo "$f"
     fi
-done
+done | Release/sampler.exe --batch - jpg $degree $samplenum $write_rendered
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "util.h"
+#include <array>
+#include <vector>
+#include <cmath>
+
+// real spherical harmonics basis with the degree fixed at compile time,
+// the branches on Degree fold away and nothing is allocated per call
+template<int Degree>
+struct SHBasis
+{
+	static_assert(Degree >= 0 && Degree <= 3, "SHBasis supports degree 0-3");
+	static const int N = (Degree + 1)*(Degree + 1);
+	static const int MaxN = N;
+	typedef std::array<float, N> Array;
+
+	int Size()const { return N; }
+
+	// x, y, z must be normalized; T is float or a SIMD Pack
+	template<typename T>
+	static void Eval(T x, T y, T z, T* Y)
+	{
+		// 1/2*sqrt(1/pi), sqrt(3/(4pi)), 1/2*sqrt(15/pi), ...
+		const float k0 = 0.282094792f;
+		const float k1 = 0.488602512f;
+		const float k2 = 1.092548431f;
+		const float k3 = 0.315391565f;
+		const float k4 = 0.546274215f;
+		const float k5 = 0.590043590f;
+		const float k6 = 2.890611443f;
+		const float k7 = 0.457045799f;
+		const float k8 = 0.373176333f;
+		const float k9 = 1.445305721f;
+
+		Y[0] = T(k0);
+		if (Degree >= 1)
+		{
+			Y[1] = k1 * z;
+			Y[2] = k1 * y;
+			Y[3] = k1 * x;
+		}
+		if (Degree >= 2)
+		{
+			T x2 = x * x;
+			T y2 = y * y;
+			T z2 = z * z;
+			Y[4] = k2 * x * z;
+			Y[5] = k2 * z * y;
+			Y[6] = k3 * (2.f * y2 - x2 - z2);
+			Y[7] = k2 * y * x;
+			Y[8] = k4 * (x2 - z2);
+			if (Degree >= 3)
+			{
+				Y[9] = k5 * (3.f * x2 - z2)*z;
+				Y[10] = k6 * x*z*y;
+				Y[11] = k7 * z*(4.f * y2 - x2 - z2);
+				Y[12] = k8 * y*(2.f * y2 - 3.f * x2 - 3.f * z2);
+				Y[13] = k7 * x*(4.f * y2 - x2 - z2);
+				Y[14] = k9 * (x2 - z2)*y;
+				Y[15] = k5 * (x2 - 3.f * z2)*x;
+			}
+		}
+	}
+
+	static void Eval(const Vec3& pos, float* Y)
+	{
+		Vec3 normal = Normalize(pos);
+		Eval<float>(normal.x, normal.y, normal.z, Y);
+	}
+
+	static Array Eval(const Vec3& pos)
+	{
+		Array Y;
+		Eval(pos, Y.data());
+		return Y;
+	}
+};
+
+// real spherical harmonics basis of any degree up to MaxDegree, built band
+// by band from the associated Legendre recurrence in O(n) per direction.
+// it follows the SHBasis conventions: y is the polar axis, index l*(l+1)+m
+// and no Condon-Shortley phase
+class SHRecurrence
+{
+public:
+	static const int MaxDegree = 15;
+	static const int MaxN = (MaxDegree + 1)*(MaxDegree + 1);
+
+	explicit SHRecurrence(int degree)
+		:degree_(degree)
+	{
+		// K(l, m) = sqrt((2l+1)/(4pi) * (l-m)!/(l+m)!), in log space
+		auto logK = [](int l, int m) {
+			return 0.5*(std::log((2 * l + 1) / (4 * M_PI)) + std::lgamma(l - m + 1.0) - std::lgamma(l + m + 1.0));
+		};
+		for (int m = 0; m <= degree; m++)
+		{
+			// K(m, m) * (2m-1)!!, times sqrt(2) for the m > 0 cos/sin pair
+			double logdf = std::lgamma(2 * m + 1.0) - m * std::log(2.0) - std::lgamma(m + 1.0);
+			double pmm = std::exp(logK(m, m) + logdf);
+			pmm_.push_back((float)(m > 0 ? std::sqrt(2.0) * pmm : pmm));
+			for (int l = m + 1; l <= degree; l++)
+			{
+				a_.push_back((float)((2 * l - 1.0) / (l - m) * std::exp(logK(l, m) - logK(l - 1, m))));
+				b_.push_back(l - 2 >= m
+					? (float)((l + m - 1.0) / (l - m) * std::exp(logK(l, m) - logK(l - 2, m)))
+					: 0.f);
+			}
+		}
+	}
+
+	int Size()const { return (degree_ + 1)*(degree_ + 1); }
+
+	// x, y, z must be normalized; T is float or a SIMD Pack
+	template<typename T>
+	void Eval(T x, T y, T z, T* Y)const
+	{
+		// c + i*s = (x + i*z)^m carries the azimuthal part
+		T c = T(1.f);
+		T s = T(0.f);
+		int k = 0;
+		for (int m = 0; m <= degree_; m++)
+		{
+			if (m > 0)
+			{
+				T c1 = x * c - z * s;
+				s = x * s + z * c;
+				c = c1;
+			}
+			T p2 = T(0.f);
+			T p1 = T(pmm_[m]);
+			for (int l = m; l <= degree_; l++)
+			{
+				if (l > m)
+				{
+					T p = a_[k] * y * p1 - b_[k] * p2;
+					p2 = p1;
+					p1 = p;
+					k++;
+				}
+				int center = l * (l + 1);
+				if (m == 0)
+				{
+					Y[center] = p1;
+				}
+				else
+				{
+					Y[center + m] = p1 * c;
+					Y[center - m] = p1 * s;
+				}
+			}
+		}
+	}
+
+	void Eval(const Vec3& pos, float* Y)const
+	{
+		Vec3 normal = Normalize(pos);
+		Eval<float>(normal.x, normal.y, normal.z, Y);
+	}
+
+private:
+	int degree_;
+	std::vector<float> pmm_;
+	// recurrence factors of P(l, m) = a*y*P(l-1, m) - b*P(l-2, m), in
+	// evaluation order
+	std::vector<float> a_, b_;
+};
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "util.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include "batch.h"
+#include "cubemap.h"
+#include "harmonics.h"
+#include "basis_table.h"
+
+using namespace std;
+
+namespace
+{
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t degree;
+		uint32_t coefnum;
+		uint32_t reserved[2];
+	};
+	const char Magic[4] = { 'S', 'H', 'T', 'B' };
+	const uint32_t Version = 1;
+
+	size_t FloatNum(int width, int height, int degree)
+	{
+		return (size_t)6 * height * width * (degree + 1) * (degree + 1);
+	}
+}
+
+BasisTable::BasisTable(int width, int height, int degree, int thread_num)
+	:width_(width), height_(height), degree_(degree)
+{
+	if (width <= 0 || height <= 0)
+		throw invalid_argument("invalid basis table size");
+	Harmonics harmonics(degree);
+	int n = CoefficientNum();
+	data_.resize(FloatNum(width, height, degree));
+	table_ = data_.data();
+
+	atomic<int> next_row(0);
+	auto work = [&]() {
+		SampleBatch row;
+		vector<float> Y(n);
+		for (int r = next_row++; r < 6 * height; r = next_row++)
+		{
+			Cubemap::TexelGeometry(width, height, r / height, r % height, row);
+			float* dst = &data_[(size_t)r * n * width];
+			for (int j = 0; j < width; j++)
+			{
+				harmonics.Basis(Vec3(row.x[j], row.y[j], row.z[j]), Y.data());
+				for (int k = 0; k < n; k++)
+					dst[k * width + j] = Y[k] * row.r[j];
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int t = 1; t < thread_num; t++)
+		workers.emplace_back(work);
+	work();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+BasisTable::BasisTable(const std::string& filename)
+	:file_(new MappedFile(filename))
+{
+	Header header;
+	if (file_->Size() < sizeof(header))
+		throw runtime_error(filename + " is not a basis table");
+	memcpy(&header, file_->Data(), sizeof(header));
+	if (memcmp(header.magic, Magic, 4) != 0 || header.version != Version
+		|| header.coefnum != (header.degree + 1)*(header.degree + 1)
+		|| header.degree > (uint32_t)Harmonics::MaxDegree)
+		throw runtime_error(filename + " is not a basis table");
+	width_ = header.width;
+	height_ = header.height;
+	degree_ = header.degree;
+	if (file_->Size() != sizeof(header) + FloatNum(width_, height_, degree_) * sizeof(float))
+		throw runtime_error(filename + " is truncated");
+	table_ = (const float*)(file_->Data() + sizeof(header));
+}
+
+std::shared_ptr<BasisTable> BasisTable::Load(const std::string& dir, int width, int height,
+	int degree, int thread_num)
+{
+	string filename = dir + "/basis_" + to_string(width) + "x" + to_string(height)
+		+ "_d" + to_string(degree) + ".bin";
+	try {
+		auto table = make_shared<BasisTable>(filename);
+		if (table->Width() == width && table->Height() == height && table->Degree() == degree)
+			return table;
+	}
+	catch (const runtime_error&) {
+		// missing or stale, rebuilt below
+	}
+	auto table = make_shared<BasisTable>(width, height, degree, thread_num);
+	try {
+		table->Save(filename);
+	}
+	catch (const runtime_error&) {
+		// unwritable cache directory, the table is still usable from memory
+	}
+	return table;
+}
+
+void BasisTable::Save(const std::string& filename)const
+{
+	Header header = {};
+	memcpy(header.magic, Magic, 4);
+	header.version = Version;
+	header.width = width_;
+	header.height = height_;
+	header.degree = degree_;
+	header.coefnum = CoefficientNum();
+
+	// written aside and renamed, so a concurrent reader never maps a partial table
+	string tmp = filename + ".tmp";
+	{
+		ofstream out(tmp, ios::binary);
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)table_, FloatNum(width_, height_, degree_) * sizeof(float));
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+	}
+	remove(filename.c_str());
+	if (rename(tmp.c_str(), filename.c_str()) != 0)
+		throw runtime_error("rename " + tmp + " failed");
+}
\ No newline at end of file
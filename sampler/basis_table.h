@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include "mapped_file.h"
+
+// basis values premultiplied by the texel solid angle for every texel of a
+// cubemap, so a texel projection is a plain dot product per coefficient.
+// each face row holds CoefficientNum() runs of Width() floats, coefficient
+// major, and rows are stored face by face
+class BasisTable
+{
+public:
+	// builds the table in memory
+	BasisTable(int width, int height, int degree, int thread_num = 1);
+	// maps a table written by Save
+	explicit BasisTable(const std::string& filename);
+	// maps DIR/basis_<w>x<h>_d<degree>.bin, building and saving it first
+	// when it is missing or does not match
+	static std::shared_ptr<BasisTable> Load(const std::string& dir, int width, int height,
+		int degree, int thread_num = 1);
+	void Save(const std::string& filename)const;
+
+	int Width()const { return width_; }
+	int Height()const { return height_; }
+	int Degree()const { return degree_; }
+	int CoefficientNum()const { return (degree_ + 1)*(degree_ + 1); }
+	// CoefficientNum() * Width() floats of one face row
+	const float* Row(int face, int row)const
+	{
+		return table_ + ((size_t)face * height_ + row) * CoefficientNum() * width_;
+	}
+private:
+	int width_;
+	int height_;
+	int degree_;
+	const float* table_;
+	std::vector<float> data_;
+	std::unique_ptr<MappedFile> file_;
+};
\ No newline at end of file
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include "util.h"
+#include "simd.h"
+#include "basis.h"
+
+// structure-of-arrays samples, directions need not be normalized
+class SampleBatch
+{
+public:
+	SampleBatch() {}
+	explicit SampleBatch(const std::vector<Vertex>& vertices)
+	{
+		Reserve(vertices.size());
+		for (const Vertex& v : vertices)
+			Push(v.pos, v.color);
+	}
+	size_t Size()const { return x.size(); }
+	std::vector<Vertex> Vertices()const
+	{
+		std::vector<Vertex> vertices(Size());
+		for (size_t i = 0; i < Size(); i++)
+			vertices[i] = { Vec3(x[i], y[i], z[i]), Vec3(r[i], g[i], b[i]) };
+		return vertices;
+	}
+	void Reserve(size_t n)
+	{
+		for (std::vector<float>* a : { &x, &y, &z, &r, &g, &b })
+			a->reserve(n);
+	}
+	void Resize(size_t n)
+	{
+		for (std::vector<float>* a : { &x, &y, &z, &r, &g, &b })
+			a->resize(n);
+	}
+	void Push(const Vec3& pos, const Vec3& color)
+	{
+		x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z);
+		r.push_back(color.r); g.push_back(color.g); b.push_back(color.b);
+	}
+	std::vector<float> x, y, z;
+	std::vector<float> r, g, b;
+};
+
+// adds Y(dir)*color of samples [begin, end) into sum[0..n), B is an
+// SHBasis or SHRecurrence
+template<typename B>
+void AccumulateBatch(const B& basis, const SampleBatch& s, size_t begin, size_t end, Vec3* sum)
+{
+	const int n = basis.Size();
+	Pack acc_r[B::MaxN], acc_g[B::MaxN], acc_b[B::MaxN];
+	size_t i = begin;
+	for (; i + Pack::Width <= end; i += Pack::Width)
+	{
+		Pack x = Pack::Load(&s.x[i]);
+		Pack y = Pack::Load(&s.y[i]);
+		Pack z = Pack::Load(&s.z[i]);
+		Pack inv = Pack(1.f) / Sqrt(x*x + y * y + z * z);
+		Pack Y[B::MaxN];
+		basis.Eval(x*inv, y*inv, z*inv, Y);
+
+		Pack r = Pack::Load(&s.r[i]);
+		Pack g = Pack::Load(&s.g[i]);
+		Pack b = Pack::Load(&s.b[i]);
+		for (int k = 0; k < n; k++)
+		{
+			acc_r[k] = acc_r[k] + Y[k] * r;
+			acc_g[k] = acc_g[k] + Y[k] * g;
+			acc_b[k] = acc_b[k] + Y[k] * b;
+		}
+	}
+	for (int k = 0; k < n; k++)
+		sum[k] = sum[k] + Vec3(ReduceAdd(acc_r[k]), ReduceAdd(acc_g[k]), ReduceAdd(acc_b[k]));
+
+	for (; i < end; i++)
+	{
+		float Y[B::MaxN];
+		basis.Eval(Vec3(s.x[i], s.y[i], s.z[i]), Y);
+		Vec3 color(s.r[i], s.g[i], s.b[i]);
+		for (int k = 0; k < n; k++)
+			sum[k] = sum[k] + Y[k] * color;
+	}
+}
+
+// AccumulateBatch that also adds the squares (Y(dir)*color)^2 into sum_sq,
+// for the variance of the per-sample estimates
+template<typename B>
+void AccumulateBatchMoments(const B& basis, const SampleBatch& s, size_t begin, size_t end,
+	Vec3* sum, Vec3* sum_sq)
+{
+	const int n = basis.Size();
+	Pack acc_r[B::MaxN], acc_g[B::MaxN], acc_b[B::MaxN];
+	Pack sq_r[B::MaxN], sq_g[B::MaxN], sq_b[B::MaxN];
+	size_t i = begin;
+	for (; i + Pack::Width <= end; i += Pack::Width)
+	{
+		Pack x = Pack::Load(&s.x[i]);
+		Pack y = Pack::Load(&s.y[i]);
+		Pack z = Pack::Load(&s.z[i]);
+		Pack inv = Pack(1.f) / Sqrt(x*x + y * y + z * z);
+		Pack Y[B::MaxN];
+		basis.Eval(x*inv, y*inv, z*inv, Y);
+
+		Pack r = Pack::Load(&s.r[i]);
+		Pack g = Pack::Load(&s.g[i]);
+		Pack b = Pack::Load(&s.b[i]);
+		for (int k = 0; k < n; k++)
+		{
+			Pack vr = Y[k] * r, vg = Y[k] * g, vb = Y[k] * b;
+			acc_r[k] = acc_r[k] + vr;
+			acc_g[k] = acc_g[k] + vg;
+			acc_b[k] = acc_b[k] + vb;
+			sq_r[k] = sq_r[k] + vr * vr;
+			sq_g[k] = sq_g[k] + vg * vg;
+			sq_b[k] = sq_b[k] + vb * vb;
+		}
+	}
+	for (int k = 0; k < n; k++)
+	{
+		sum[k] = sum[k] + Vec3(ReduceAdd(acc_r[k]), ReduceAdd(acc_g[k]), ReduceAdd(acc_b[k]));
+		sum_sq[k] = sum_sq[k] + Vec3(ReduceAdd(sq_r[k]), ReduceAdd(sq_g[k]), ReduceAdd(sq_b[k]));
+	}
+
+	for (; i < end; i++)
+	{
+		float Y[B::MaxN];
+		basis.Eval(Vec3(s.x[i], s.y[i], s.z[i]), Y);
+		for (int k = 0; k < n; k++)
+		{
+			Vec3 v = Y[k] * Vec3(s.r[i], s.g[i], s.b[i]);
+			sum[k] = sum[k] + v;
+			sum_sq[k] = sum_sq[k] + Vec3(v.r * v.r, v.g * v.g, v.b * v.b);
+		}
+	}
+}
+
+// writes sum(Y(dir)*coefs) of count directions into r, g, b, skipping the
+// normalization when the directions are already unit length
+template<typename B>
+void RenderBatch(const B& basis, const float* x, const float* y, const float* z, size_t count,
+	const Vec3* coefs, float* r, float* g, float* b, bool normalized = false)
+{
+	const int n = basis.Size();
+	Pack cr[B::MaxN], cg[B::MaxN], cb[B::MaxN];
+	for (int k = 0; k < n; k++)
+	{
+		cr[k] = coefs[k].r;
+		cg[k] = coefs[k].g;
+		cb[k] = coefs[k].b;
+	}
+	size_t i = 0;
+	for (; i + Pack::Width <= count; i += Pack::Width)
+	{
+		Pack px = Pack::Load(x + i);
+		Pack py = Pack::Load(y + i);
+		Pack pz = Pack::Load(z + i);
+		if (!normalized)
+		{
+			Pack inv = Pack(1.f) / Sqrt(px*px + py * py + pz * pz);
+			px = px * inv;
+			py = py * inv;
+			pz = pz * inv;
+		}
+		Pack Y[B::MaxN];
+		basis.Eval(px, py, pz, Y);
+
+		Pack sr, sg, sb;
+		for (int k = 0; k < n; k++)
+		{
+			sr = sr + Y[k] * cr[k];
+			sg = sg + Y[k] * cg[k];
+			sb = sb + Y[k] * cb[k];
+		}
+		sr.Store(r + i);
+		sg.Store(g + i);
+		sb.Store(b + i);
+	}
+	for (; i < count; i++)
+	{
+		float Y[B::MaxN];
+		basis.Eval(Vec3(x[i], y[i], z[i]), Y);
+		Vec3 color;
+		for (int k = 0; k < n; k++)
+			color = color + Y[k] * coefs[k];
+		r[i] = color.r;
+		g[i] = color.g;
+		b[i] = color.b;
+	}
+}
\ No newline at end of file
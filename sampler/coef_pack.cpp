@@ -0,0 +1,150 @@
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+#include "coef_pack.h"
+
+using namespace std;
+
+namespace
+{
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t count;
+	};
+	const char Magic[4] = { 'S', 'H', 'C', 'P' };
+	const uint32_t Version = 1;
+}
+
+CoefPack::CoefPack(const std::string& filename)
+	:file_(filename)
+{
+	Header header;
+	if (file_.Size() < sizeof(header))
+		throw runtime_error(filename + " is not a coefficient pack");
+	memcpy(&header, file_.Data(), sizeof(header));
+	if (memcmp(header.magic, Magic, 4) != 0)
+		throw runtime_error(filename + " is not a coefficient pack");
+	if (header.version != Version)
+		throw runtime_error(filename + ": unsupported pack version " + to_string(header.version));
+	if (header.count > (file_.Size() - sizeof(header)) / sizeof(CoefPackEntry))
+		throw runtime_error(filename + " is truncated");
+	count_ = (size_t)header.count;
+	entries_ = (const CoefPackEntry*)(file_.Data() + sizeof(header));
+	for (size_t i = 0; i < count_; i++)
+	{
+		const CoefPackEntry& e = entries_[i];
+		if (e.name[sizeof(e.name) - 1] != 0 || e.coefnum != (e.degree + 1)*(e.degree + 1)
+			|| e.offset % sizeof(float) != 0
+			|| e.offset > file_.Size() || (file_.Size() - e.offset) / (3 * sizeof(float)) < e.coefnum)
+			throw runtime_error(filename + " is corrupted");
+	}
+}
+
+int CoefPack::Find(const std::string& name)const
+{
+	auto less = [](const CoefPackEntry& e, const string& n) { return strcmp(e.name, n.c_str()) < 0; };
+	const CoefPackEntry* it = lower_bound(entries_, entries_ + count_, name, less);
+	if (it == entries_ + count_ || name != it->name)
+		return -1;
+	return (int)(it - entries_);
+}
+
+void CoefPackWriter::Add(const std::string& name, int degree, uint64_t samplenum, uint64_t source_hash,
+	const float* rgb)
+{
+	Item item = {};
+	if (name.size() >= sizeof(item.entry.name))
+		throw invalid_argument("environment name too long: " + name);
+	memcpy(item.entry.name, name.c_str(), name.size());
+	item.entry.source_hash = source_hash;
+	item.entry.samplenum = samplenum;
+	item.entry.degree = degree;
+	item.entry.coefnum = (degree + 1)*(degree + 1);
+	item.rgb.assign(rgb, rgb + 3 * item.entry.coefnum);
+
+	auto it = index_.find(name);
+	if (it != index_.end())
+		items_[it->second] = move(item);
+	else
+	{
+		index_[name] = items_.size();
+		items_.push_back(move(item));
+	}
+}
+
+void CoefPackWriter::Merge(const std::string& filename)
+{
+	if (!ifstream(filename))
+		return;
+	CoefPack pack(filename);
+	for (size_t i = 0; i < pack.Size(); i++)
+	{
+		const CoefPackEntry& e = pack.Entry(i);
+		if (index_.count(e.name) == 0)
+			Add(e.name, e.degree, e.samplenum, e.source_hash, pack.Coefficients(i));
+	}
+}
+
+void CoefPackWriter::Write(const std::string& filename)const
+{
+	vector<const Item*> sorted;
+	for (const Item& item : items_)
+		sorted.push_back(&item);
+	sort(sorted.begin(), sorted.end(), [](const Item* a, const Item* b) {
+		return strcmp(a->entry.name, b->entry.name) < 0;
+	});
+
+	Header header = {};
+	memcpy(header.magic, Magic, 4);
+	header.version = Version;
+	header.count = sorted.size();
+	uint64_t offset = sizeof(header) + sorted.size() * sizeof(CoefPackEntry);
+
+	string tmp = filename + ".tmp";
+	{
+		ofstream out(tmp, ios::binary);
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+		out.write((const char*)&header, sizeof(header));
+		for (const Item* item : sorted)
+		{
+			CoefPackEntry entry = item->entry;
+			entry.offset = offset;
+			offset += item->rgb.size() * sizeof(float);
+			out.write((const char*)&entry, sizeof(entry));
+		}
+		for (const Item* item : sorted)
+			out.write((const char*)item->rgb.data(), item->rgb.size() * sizeof(float));
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+	}
+	remove(filename.c_str());
+	if (rename(tmp.c_str(), filename.c_str()) != 0)
+		throw runtime_error("rename " + tmp + " failed");
+}
+
+uint64_t SourceHash(const std::vector<std::string>& files)
+{
+	uint64_t hash = 14695981039346656037ull;
+	vector<char> buffer(1 << 16);
+	for (const string& filename : files)
+	{
+		ifstream file(filename, ios::binary);
+		if (!file)
+			throw runtime_error("open " + filename + " failed");
+		while (file)
+		{
+			file.read(buffer.data(), buffer.size());
+			for (streamsize i = 0; i < file.gcount(); i++)
+			{
+				hash ^= (unsigned char)buffer[i];
+				hash *= 1099511628211ull;
+			}
+		}
+	}
+	return hash;
+}
\ No newline at end of file
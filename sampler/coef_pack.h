@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "mapped_file.h"
+
+// binary container of the coefficients of many environments. a 16 byte
+// header is followed by the entries sorted by name and then the
+// coefficients as r, g, b floats, so a mapped pack is read in place
+struct CoefPackEntry
+{
+	char name[96];
+	uint64_t source_hash;
+	uint64_t samplenum;
+	uint32_t degree;
+	uint32_t coefnum;
+	// byte offset of the coefficients from the start of the pack
+	uint64_t offset;
+};
+
+class CoefPack
+{
+public:
+	explicit CoefPack(const std::string& filename);
+	size_t Size()const { return count_; }
+	const CoefPackEntry& Entry(size_t i)const { return entries_[i]; }
+	// 3 * Entry(i).coefnum floats
+	const float* Coefficients(size_t i)const
+	{
+		return (const float*)(file_.Data() + entries_[i].offset);
+	}
+	// entry index of name, -1 when missing
+	int Find(const std::string& name)const;
+private:
+	MappedFile file_;
+	size_t count_;
+	const CoefPackEntry* entries_;
+};
+
+class CoefPackWriter
+{
+public:
+	// rgb holds 3 * (degree + 1)^2 floats; a name added twice keeps the last
+	void Add(const std::string& name, int degree, uint64_t samplenum, uint64_t source_hash,
+		const float* rgb);
+	// adds the entries of the pack at filename whose names were not added
+	// here, so a following Write replaces only these; a missing file adds nothing
+	void Merge(const std::string& filename);
+	// written aside and renamed over filename
+	void Write(const std::string& filename)const;
+private:
+	struct Item
+	{
+		CoefPackEntry entry;
+		std::vector<float> rgb;
+	};
+	std::vector<Item> items_;
+	std::unordered_map<std::string, size_t> index_;
+};
+
+// FNV-1a hash of the contents of the source image files
+uint64_t SourceHash(const std::vector<std::string>& files);
\ No newline at end of file
@@ -3,25 +3,327 @@
 #include <opencv2/highgui.hpp>
 #include <stdexcept>
 #include <fstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cmath>
 #include "cubemap.h"
+#include "batch.h"
 
 using namespace std;
 
-Cubemap::Cubemap(std::array<std::string, 6> image_filenames)
+cv::Size JpegSize(const std::string& filename)
 {
-	for (int i = 0; i < 6; i++)
+	ifstream file(filename, ios::binary);
+	auto byte = [&file]() { return file.get(); };
+	if (byte() != 0xFF || byte() != 0xD8)
+		return cv::Size(0, 0);
+	while (file)
 	{
-		cv::Mat img = cv::imread(image_filenames[i]);
-		if (!img.data)
-			throw std::runtime_error("read image failed: " + image_filenames[i]);
-		img.convertTo(images_[i], CV_32FC3, 1.0 / 255.0);
+		int c = byte();
+		if (c != 0xFF)
+			continue;
+		int marker = byte();
+		while (marker == 0xFF)
+			marker = byte();
+		// markers without a segment
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD9))
+			continue;
+		int length = byte() << 8;
+		length |= byte();
+		// SOF0..SOF15 except DHT, JPG and DAC
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			byte();
+			int height = byte() << 8;
+			height |= byte();
+			int width = byte() << 8;
+			width |= byte();
+			return file ? cv::Size(width, height) : cv::Size(0, 0);
+		}
+		if (marker == 0xDA || length < 2)
+			return cv::Size(0, 0);
+		file.ignore(length - 2);
 	}
+	return cv::Size(0, 0);
+}
+
+// imread flag decoding filename at the smallest DCT scale that keeps at
+// least min_size pixels across
+static int ReducedReadFlag(const std::string& filename, int min_size)
+{
+	if (min_size <= 0)
+		return cv::IMREAD_COLOR;
+	int width = JpegSize(filename).width;
+	if (width / 8 >= min_size)
+		return cv::IMREAD_REDUCED_COLOR_8;
+	if (width / 4 >= min_size)
+		return cv::IMREAD_REDUCED_COLOR_4;
+	if (width / 2 >= min_size)
+		return cv::IMREAD_REDUCED_COLOR_2;
+	return cv::IMREAD_COLOR;
+}
+
+Cubemap::Cubemap(std::array<std::string, 6> image_filenames, Storage storage, int min_size)
+{
+	// faces are decoded concurrently, errors are rethrown once all are done.
+	// float and half storages decode 16-bit and floating point sources
+	// (png, pfm, exr, hdr) at their depth, so values above 1 are kept
+	bool hdr = storage == Storage::Float || storage == Storage::PlanarHalf;
+	array<string, 6> errors;
+	auto read = [&](int i) {
+		int flag = ReducedReadFlag(image_filenames[i], min_size);
+		if (hdr && flag == cv::IMREAD_COLOR)
+			flag |= cv::IMREAD_ANYDEPTH;
+		cv::Mat img = cv::imread(image_filenames[i], flag);
+		if (!img.data)
+			errors[i] = "read image failed: " + image_filenames[i];
+		else if (!hdr)
+			images_[i] = img;
+		else
+			img.convertTo(images_[i], CV_32FC3, img.depth() == CV_8U ? 1.0 / 255.0
+				: img.depth() == CV_16U ? 1.0 / 65535.0 : 1.0);
+	};
+	vector<thread> workers;
+	for (int i = 1; i < 6; i++)
+		workers.emplace_back(read, i);
+	read(0);
+	for (auto& worker : workers)
+		worker.join();
+	for (const string& error : errors)
+		if (!error.empty())
+			throw std::runtime_error(error);
+	width_ = images_[0].cols;
+	height_ = images_[0].rows;
+	for (int i = 1; i < 6; i++)
+		if (images_[i].cols != Width() || images_[i].rows != Height())
+			throw std::runtime_error("face size mismatch: " + image_filenames[i]);
+	storage_ = hdr ? Storage::Float : Storage::Byte;
+	// planar storages are filled from the decoded faces
+	if (storage != storage_)
+		*this = Convert(storage, 6);
 }
 
 Cubemap::Cubemap(std::array<cv::Mat, 6> images)
-	:images_(images)
+	:storage_(images[0].depth() == CV_8U ? Storage::Byte : Storage::Float),
+	width_(images[0].cols), height_(images[0].rows), images_(images)
+{
+
+}
+
+// 8-bit channel to [0, 1]
+static const float* ByteToFloat()
+{
+	static const array<float, 256> lut = []() {
+		array<float, 256> t;
+		for (int i = 0; i < 256; i++)
+			t[i] = i / 255.f;
+		return t;
+	}();
+	return lut.data();
+}
+
+// IEEE half precision, rounded to nearest even
+static uint16_t FloatToHalf(float value)
+{
+	uint32_t x;
+	memcpy(&x, &value, sizeof(x));
+	uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+	uint32_t bits = x & 0x7FFFFFFF;
+	if (bits >= 0x7F800000)
+		return sign | 0x7C00 | (bits > 0x7F800000 ? 0x200 : 0);
+	if (bits < 0x38800000)
+	{
+		// subnormal, the mantissa counts units of 2^-24
+		float magnitude;
+		memcpy(&magnitude, &bits, sizeof(magnitude));
+		return sign | (uint16_t)lrintf(magnitude * 16777216.f);
+	}
+	// rebias the exponent from 127 to 15, a carry out of the mantissa
+	// moves into the exponent and saturates at infinity
+	uint32_t h = (bits - 0x38000000) >> 13;
+	uint32_t rest = bits & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+		h++;
+	return sign | (uint16_t)min<uint32_t>(h, 0x7C00);
+}
+
+static float HalfToFloat(uint16_t h)
+{
+	// exponent and mantissa moved into float position and scaled by 2^112
+	// rebias normals and subnormals alike; only inf and nan need the
+	// exponent set apart
+	uint32_t bits = (uint32_t)(h & 0x7FFF) << 13;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	value *= 5.192296858534828e33f;
+	memcpy(&bits, &value, sizeof(bits));
+	if ((h & 0x7C00) == 0x7C00)
+		bits |= 0x7F800000;
+	bits |= (uint32_t)(h & 0x8000) << 16;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static unsigned char FloatToByte(float value)
+{
+	return (unsigned char)min(255.f, max(0.f, std::round(value * 255.f)));
+}
+
+Cubemap Cubemap::Convert(Storage storage, int thread_num)const
+{
+	Cubemap result;
+	result.storage_ = storage;
+	result.width_ = width_;
+	result.height_ = height_;
+	int w = width_;
+	int h = height_;
+	if (result.Planar())
+	{
+		size_t element = storage == Storage::PlanarHalf ? 2 : 1;
+		result.stride_ = (w * element + 63) / 64 * 64;
+		result.plane_buffer_ = make_shared<vector<unsigned char>>(18 * h * result.stride_ + 63);
+		unsigned char* data = result.plane_buffer_->data();
+		result.planes_ = data + (64 - (uintptr_t)data % 64) % 64;
+	}
+	else
+	{
+		for (int face = 0; face < 6; face++)
+			result.images_[face] = cv::Mat(h, w, storage == Storage::Float ? CV_32FC3 : CV_8UC3);
+	}
+
+	atomic<int> next_row(0);
+	auto work = [&]() {
+		vector<float> colors[3] = { vector<float>(w), vector<float>(w), vector<float>(w) };
+		for (int r = next_row++; r < 6 * h; r = next_row++)
+		{
+			int face = r / h;
+			int row = r % h;
+			RowColors(face, row, colors[0].data(), colors[1].data(), colors[2].data());
+			switch (storage)
+			{
+			case Storage::Float:
+			{
+				cv::Vec3f* dst = result.images_[face].ptr<cv::Vec3f>(row);
+				for (int j = 0; j < w; j++)
+					dst[j] = cv::Vec3f(colors[2][j], colors[1][j], colors[0][j]);
+				break;
+			}
+			case Storage::Byte:
+			{
+				cv::Vec3b* dst = result.images_[face].ptr<cv::Vec3b>(row);
+				for (int j = 0; j < w; j++)
+					dst[j] = cv::Vec3b(FloatToByte(colors[2][j]), FloatToByte(colors[1][j]), FloatToByte(colors[0][j]));
+				break;
+			}
+			case Storage::PlanarByte:
+				for (int c = 0; c < 3; c++)
+				{
+					unsigned char* dst = (unsigned char*)result.PlaneRow(face, c, row);
+					for (int j = 0; j < w; j++)
+						dst[j] = FloatToByte(colors[c][j]);
+				}
+				break;
+			case Storage::PlanarHalf:
+				for (int c = 0; c < 3; c++)
+				{
+					uint16_t* dst = (uint16_t*)result.PlaneRow(face, c, row);
+					for (int j = 0; j < w; j++)
+						dst[j] = FloatToHalf(colors[c][j]);
+				}
+				break;
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int t = 1; t < thread_num; t++)
+		workers.emplace_back(work);
+	work();
+	for (auto& worker : workers)
+		worker.join();
+	return result;
+}
+
+size_t Cubemap::TexelBytes()const
 {
+	if (Planar())
+		return 18 * (size_t)height_ * stride_;
+	size_t bytes = 0;
+	for (const cv::Mat& img : images_)
+		bytes += img.total() * img.elemSize();
+	return bytes;
+}
 
+Vec3 Cubemap::Texel(int face, int i, int j)const
+{
+	if (storage_ == Storage::PlanarByte)
+	{
+		const float* lut = ByteToFloat();
+		return Vec3{ lut[((const unsigned char*)PlaneRow(face, 0, i))[j]],
+			lut[((const unsigned char*)PlaneRow(face, 1, i))[j]],
+			lut[((const unsigned char*)PlaneRow(face, 2, i))[j]] };
+	}
+	if (storage_ == Storage::PlanarHalf)
+	{
+		return Vec3{ HalfToFloat(((const uint16_t*)PlaneRow(face, 0, i))[j]),
+			HalfToFloat(((const uint16_t*)PlaneRow(face, 1, i))[j]),
+			HalfToFloat(((const uint16_t*)PlaneRow(face, 2, i))[j]) };
+	}
+	const cv::Mat& img = images_[face];
+	if (img.depth() == CV_8U)
+	{
+		const float* lut = ByteToFloat();
+		auto c = img.at<cv::Vec3b>(i, j);
+		return Vec3{ lut[c[2]], lut[c[1]], lut[c[0]] };
+	}
+	auto c = img.at<cv::Vec3f>(i, j);
+	return Vec3{ c[2], c[1], c[0] };
+}
+
+void Cubemap::RowColors(int face, int row, float* r, float* g, float* b)const
+{
+	if (Planar())
+	{
+		float* dst[3] = { r, g, b };
+		for (int c = 0; c < 3; c++)
+		{
+			if (storage_ == Storage::PlanarByte)
+			{
+				const float* lut = ByteToFloat();
+				const unsigned char* src = (const unsigned char*)PlaneRow(face, c, row);
+				for (int j = 0; j < width_; j++)
+					dst[c][j] = lut[src[j]];
+			}
+			else
+			{
+				const uint16_t* src = (const uint16_t*)PlaneRow(face, c, row);
+				for (int j = 0; j < width_; j++)
+					dst[c][j] = HalfToFloat(src[j]);
+			}
+		}
+		return;
+	}
+	const cv::Mat& img = images_[face];
+	if (img.depth() == CV_8U)
+	{
+		const float* lut = ByteToFloat();
+		const cv::Vec3b* texels = img.ptr<cv::Vec3b>(row);
+		for (int j = 0; j < img.cols; j++)
+		{
+			r[j] = lut[texels[j][2]];
+			g[j] = lut[texels[j][1]];
+			b[j] = lut[texels[j][0]];
+		}
+		return;
+	}
+	const cv::Vec3f* texels = img.ptr<cv::Vec3f>(row);
+	for (int j = 0; j < img.cols; j++)
+	{
+		r[j] = texels[j][2];
+		g[j] = texels[j][1];
+		b[j] = texels[j][0];
+	}
 }
 
 std::vector<Vertex> Cubemap::getVertices()
@@ -31,24 +333,23 @@ std::vector<Vertex> Cubemap::getVertices()
 	std::vector<Vertex> vertices(w*h * 6);
 	for (int k = 0; k < 6; k++)
 	{
-		cv::Mat img = images_[k];
-		for (int j = 0; j < w; j++)
+		const cv::Mat& img = images_[k];
+		for (int i = 0; i < h; i++)
 		{
-			for (int i = 0; i < h; i++)
+			for (int j = 0; j < w; j++)
 			{
-				auto c = img.at<cv::Vec3f>(i, j);
 				int idx = k * w*h + i * img.cols + j;
 				float u = (float)j / (img.cols - 1);
 				float v = 1.0f - (float)i / (img.rows - 1);
 				Vec3 p = CubeUV2XYZ({ k, u, v });
-				vertices[idx] = { p, {c[2], c[1], c[0]} };
+				vertices[idx] = { p, Texel(k, i, j) };
 			}
 		}
 	}
 	return vertices;
 }
 
-cv::Mat Cubemap::GenExpandImage(int maxsize)
+cv::Mat Cubemap::GenExpandImage(int maxsize)const
 {
 	int w = Width();
 	int h = Height();
@@ -64,14 +365,30 @@ cv::Mat Cubemap::GenExpandImage(int maxsize)
 	for (int i = 0; i < 6; i++)
 	{
 		cv::Rect region(xarr[i], yarr[i], w, h);
+		cv::Mat face = images_[i];
+		if (Planar())
+		{
+			// planar faces are interleaved one at a time for the resize
+			face = cv::Mat(Height(), Width(), CV_32FC3);
+			vector<float> r(Width()), g(Width()), b(Width());
+			for (int row = 0; row < Height(); row++)
+			{
+				RowColors(i, row, r.data(), g.data(), b.data());
+				cv::Vec3f* dst = face.ptr<cv::Vec3f>(row);
+				for (int j = 0; j < Width(); j++)
+					dst[j] = cv::Vec3f(b[j], g[j], r[j]);
+			}
+		}
 		cv::Mat img;
-		cv::resize(images_[i], img, cv::Size(w, h));
+		cv::resize(face, img, cv::Size(w, h));
+		if (img.depth() == CV_8U)
+			img.convertTo(img, CV_32FC3, 1.0 / 255.0);
 		img.copyTo(expandimg(region));
 	}
 	return expandimg;
 }
 
-std::vector<Vertex> Cubemap::RandomSample(int n)
+std::vector<Vertex> Cubemap::RandomSample(int n)const
 {
 	vector<Vertex> samples(n);
 	for (int i = 0; i < n; i++)
@@ -89,17 +406,66 @@ std::vector<Vertex> Cubemap::RandomSample(int n)
 	return samples;
 }
 
-Vec3 Cubemap::Sample(const Vec3& pos)
+Vec3 Cubemap::Sample(const Vec3& pos)const
 {
 	CubeUV cubeuv = XYZ2CubeUV(pos);
 	
-	int j = (int)(cubeuv.u * (Width() - 1));
-	int i = (int)((1.f - cubeuv.v)*(Height() - 1));
-	auto c = images_[cubeuv.index].at<cv::Vec3f>(i, j);
-	return Vec3{ c[2], c[1], c[0] };
+	int j = min((int)(cubeuv.u * Width()), Width() - 1);
+	int i = min((int)((1.f - cubeuv.v) * Height()), Height() - 1);
+	return Texel(cubeuv.index, i, j);
 }
 
-Vec3 Cubemap::Sample(float theta, float phi)
+void Cubemap::Sample(SampleBatch& samples)const
+{
+	if (Planar())
+	{
+		// offsets of a block of lookups first, then one gather per channel
+		// plane; the same texel is picked as by Sample(Vec3)
+		const size_t block = 256;
+		size_t offsets[block];
+		size_t element = storage_ == Storage::PlanarHalf ? 2 : 1;
+		size_t stride = stride_ / element;
+		size_t plane = (size_t)height_ * stride;
+		const float* lut = ByteToFloat();
+		for (size_t first = 0; first < samples.Size(); first += block)
+		{
+			size_t n = min(block, samples.Size() - first);
+			for (size_t k = 0; k < n; k++)
+			{
+				CubeUV c = XYZ2CubeUV(Vec3(samples.x[first + k], samples.y[first + k], samples.z[first + k]));
+				int j = min((int)(c.u * width_), width_ - 1);
+				int i = min((int)((1.f - c.v) * height_), height_ - 1);
+				offsets[k] = (size_t)3 * c.index * plane + i * stride + j;
+			}
+			float* dst[3] = { &samples.r[first], &samples.g[first], &samples.b[first] };
+			for (int c = 0; c < 3; c++)
+			{
+				if (storage_ == Storage::PlanarByte)
+				{
+					const unsigned char* src = planes_ + c * plane;
+					for (size_t k = 0; k < n; k++)
+						dst[c][k] = lut[src[offsets[k]]];
+				}
+				else
+				{
+					const uint16_t* src = (const uint16_t*)planes_ + c * plane;
+					for (size_t k = 0; k < n; k++)
+						dst[c][k] = HalfToFloat(src[offsets[k]]);
+				}
+			}
+		}
+		return;
+	}
+	for (size_t i = 0; i < samples.Size(); i++)
+	{
+		Vec3 c = Sample(Vec3(samples.x[i], samples.y[i], samples.z[i]));
+		samples.r[i] = c.r;
+		samples.g[i] = c.g;
+		samples.b[i] = c.b;
+	}
+}
+
+Vec3 Cubemap::Sample(float theta, float phi)const
 {
 	Vec3 s;
 	s.radius = 1;
@@ -108,3 +474,112 @@ Vec3 Cubemap::Sample(float theta, float phi)
 	Vec3 p = Spherical2Cartesian(s);
 	return Sample(p);
 }
+
+// solid angle subtended by [0, x] x [0, y] on the z = 1 face plane. texel
+// weights are differences of differences of these, so they are taken in
+// double: in float the cancellation leaves only noise past 1K faces
+static double AreaElement(double x, double y)
+{
+	return std::atan2(x * y, std::sqrt(x * x + y * y + 1));
+}
+
+void Cubemap::TexelGeometry(int width, int height, int face, int row, SampleBatch& samples)
+{
+	samples.Resize(width);
+	float v = 1.f - (row + 0.5f) / height;
+	double t0 = 1.0 - 2.0 * row / height;
+	double t1 = 1.0 - 2.0 * (row + 1) / height;
+	double a0 = AreaElement(-1.0, t0) - AreaElement(-1.0, t1);
+	for (int j = 0; j < width; j++)
+	{
+		double s1 = 2.0 * (j + 1) / width - 1.0;
+		double a1 = AreaElement(s1, t0) - AreaElement(s1, t1);
+		float weight = (float)std::abs(a1 - a0);
+		a0 = a1;
+
+		Vec3 p = CubeUV2XYZ({ face, (j + 0.5f) / width, v });
+		samples.x[j] = p.x;
+		samples.y[j] = p.y;
+		samples.z[j] = p.z;
+		samples.r[j] = weight;
+		samples.g[j] = weight;
+		samples.b[j] = weight;
+	}
+}
+
+Cubemap Cubemap::Downsample(int thread_num)const
+{
+	int w = Width();
+	int h = Height();
+	if (w % 2 != 0 || h % 2 != 0)
+		throw runtime_error("cannot downsample odd face size " + to_string(w) + "x" + to_string(h));
+	array<cv::Mat, 6> images;
+	for (int face = 0; face < 6; face++)
+		images[face] = cv::Mat(h / 2, w / 2, CV_32FC3);
+
+	atomic<int> next_row(0);
+	auto work = [&]() {
+		SampleBatch weights[2];
+		vector<float> colors[2][3];
+		for (int k = 0; k < 2; k++)
+			for (auto& c : colors[k])
+				c.resize(w);
+		for (int r = next_row++; r < 3 * h; r = next_row++)
+		{
+			int face = r / (h / 2);
+			int row = r % (h / 2);
+			for (int k = 0; k < 2; k++)
+			{
+				TexelGeometry(w, h, face, 2 * row + k, weights[k]);
+				RowColors(face, 2 * row + k, colors[k][0].data(), colors[k][1].data(), colors[k][2].data());
+			}
+			cv::Vec3f* dst = images[face].ptr<cv::Vec3f>(row);
+			for (int j = 0; j < w / 2; j++)
+			{
+				float sum[3] = { 0, 0, 0 };
+				float total = 0;
+				for (int k = 0; k < 2; k++)
+				{
+					for (int d = 2 * j; d < 2 * j + 2; d++)
+					{
+						float weight = weights[k].r[d];
+						total += weight;
+						for (int c = 0; c < 3; c++)
+							sum[c] += weight * colors[k][c][d];
+					}
+				}
+				dst[j] = cv::Vec3f(sum[2] / total, sum[1] / total, sum[0] / total);
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int t = 1; t < thread_num; t++)
+		workers.emplace_back(work);
+	work();
+	for (auto& worker : workers)
+		worker.join();
+	return Cubemap(images);
+}
+
+Cubemap Cubemap::MipLevel(int min_size, int thread_num)const
+{
+	Cubemap level = *this;
+	while (level.Width() % 2 == 0 && level.Height() % 2 == 0
+		&& level.Width() / 2 >= min_size && level.Height() / 2 >= min_size)
+		level = level.Downsample(thread_num);
+	return level;
+}
+
+void Cubemap::TexelRow(int face, int row, SampleBatch& samples)const
+{
+	int w = Width();
+	TexelGeometry(w, Height(), face, row, samples);
+	vector<float> r(w), g(w), b(w);
+	RowColors(face, row, r.data(), g.data(), b.data());
+	for (int j = 0; j < w; j++)
+	{
+		samples.r[j] *= r[j];
+		samples.g[j] *= g[j];
+		samples.b[j] *= b[j];
+	}
+}
@@ -2,22 +2,83 @@
 
 #include <array>
 #include <vector>
+#include <memory>
+#include <cstdint>
 #include <opencv2/core.hpp>
 #include "util.h"
 
+class SampleBatch;
+
 class Cubemap
 {
 public:
+	// texel layout. Float and Byte keep the faces as interleaved BGR
+	// cv::Mat; the planar modes keep separate R, G and B rows, each padded to
+	// a 64 byte line, in 8-bit or half float, so lookups gather every channel
+	// without swizzling. Byte and PlanarByte take a quarter of the float
+	// memory, PlanarHalf half of it and keeps values above 1 of high
+	// dynamic range sources
+	enum class Storage { Float, Byte, PlanarByte, PlanarHalf };
+
 	// +x, -x, +y, -y, +z, -z
-	Cubemap(std::array<std::string, 6> image_filenames);
+	// faces are decoded in parallel into storage, 8-bit storages convert
+	// texels through a lookup table when sampled. Float and PlanarHalf read
+	// 16-bit and floating point images (pfm, exr, hdr) at full range, 8-bit
+	// storages clamp them to [0, 1]. JPEG faces wider than
+	// min_size are decoded at the coarsest 1/2, 1/4 or 1/8 DCT scale that is
+	// still min_size wide
+	Cubemap(std::array<std::string, 6> image_filenames, Storage storage = Storage::Float, int min_size = 0);
+	// CV_32FC3 or CV_8UC3 faces
 	Cubemap(std::array<cv::Mat, 6> images);
+	// copy of the texels in storage, rows are converted by thread_num threads
+	Cubemap Convert(Storage storage, int thread_num = 1)const;
+	Storage GetStorage()const { return storage_; }
+	// bytes held by the texels, padding included
+	size_t TexelBytes()const;
 	std::vector<Vertex> getVertices();
-	cv::Mat GenExpandImage(int maxsize = 480);
-	int Width()const { return images_[0].cols; }
-	int Height()const { return images_[0].rows; }
-	std::vector<Vertex> RandomSample(int sqrt_n);
-	Vec3 Sample(const Vec3& pos);
-	Vec3 Sample(float theta, float phi);
+	cv::Mat GenExpandImage(int maxsize = 480)const;
+	int Width()const { return width_; }
+	int Height()const { return height_; }
+	size_t TexelNum()const { return 6 * (size_t)Width() * Height(); }
+	std::vector<Vertex> RandomSample(int sqrt_n)const;
+	Vec3 Sample(const Vec3& pos)const;
+	// looks up the colors of the directions already in samples
+	void Sample(SampleBatch& samples)const;
+	Vec3 Sample(float theta, float phi)const;
+	// texels of one face row with colors weighted by their exact solid angle,
+	// texel (i, j) covers u in [j/w, (j+1)/w] and v in [1-(i+1)/h, 1-i/h]
+	void TexelRow(int face, int row, SampleBatch& samples)const;
+	// next level of the mip chain, every texel the solid angle weighted
+	// mean of its 2x2 children so integrals over the sphere are kept;
+	// rows are split over thread_num threads and faces must have even size
+	Cubemap Downsample(int thread_num = 1)const;
+	// coarsest level of the mip chain still at least min_size wide
+	Cubemap MipLevel(int min_size, int thread_num = 1)const;
+	// colors of the texels of a face row as separate channels
+	void RowColors(int face, int row, float* r, float* g, float* b)const;
+	// directions of the texels of a face row with their solid angles in r, g, b
+	static void TexelGeometry(int width, int height, int face, int row, SampleBatch& samples);
 private:
+	Cubemap() {}
+	Vec3 Texel(int face, int i, int j)const;
+	// row of channel c of face in the planar buffer
+	const void* PlaneRow(int face, int c, int row)const
+	{
+		return planes_ + ((size_t)(3 * face + c) * height_ + row) * stride_;
+	}
+	bool Planar()const { return storage_ == Storage::PlanarByte || storage_ == Storage::PlanarHalf; }
+
+	Storage storage_ = Storage::Float;
+	int width_ = 0;
+	int height_ = 0;
+	// interleaved storages
 	std::array<cv::Mat, 6> images_;
-};
\ No newline at end of file
+	// planar storages: 6 faces x 3 channels x height rows of stride_ bytes,
+	// starting at a 64 byte boundary of plane_buffer_
+	std::shared_ptr<std::vector<unsigned char>> plane_buffer_;
+	const unsigned char* planes_ = nullptr;
+	size_t stride_ = 0;
+};
+
+// pixel size from the frame header of a JPEG, 0 x 0 when filename is not one
+cv::Size JpegSize(const std::string& filename);
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "util.h"
+#include <stdexcept>
+#include <cstdint>
+#include "generator.h"
+#include "batch.h"
+
+using namespace std;
+
+static float RadicalInverse2(uint32_t i)
+{
+	i = (i << 16) | (i >> 16);
+	i = ((i & 0x00ff00ffu) << 8) | ((i & 0xff00ff00u) >> 8);
+	i = ((i & 0x0f0f0f0fu) << 4) | ((i & 0xf0f0f0f0u) >> 4);
+	i = ((i & 0x33333333u) << 2) | ((i & 0xccccccccu) >> 2);
+	i = ((i & 0x55555555u) << 1) | ((i & 0xaaaaaaaau) >> 1);
+	return (i >> 8) * (1.f / (1 << 24));
+}
+
+// second dimension of the Sobol sequence (primitive polynomial x + 1)
+static float Sobol2(uint32_t i)
+{
+	uint32_t r = 0;
+	for (uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1)
+	{
+		if (i & 1)
+			r ^= v;
+	}
+	return (r >> 8) * (1.f / (1 << 24));
+}
+
+// maps the unit square to the unit sphere preserving area
+static Vec3 SquareToSphere(float u, float v)
+{
+	float y = 1.f - 2.f * u;
+	float r = std::sqrt(std::max(0.f, 1.f - y * y));
+	float phi = 2 * PI * v;
+	return { r * std::cos(phi), y, r * std::sin(phi) };
+}
+
+const std::vector<std::string>& DirectionGenerator::Strategies()
+{
+	static const vector<string> names = { "random", "sobol", "hammersley", "fibonacci", "stratified" };
+	return names;
+}
+
+DirectionGenerator::DirectionGenerator(const std::string& strategy, size_t samplenum, uint64_t seed)
+	:size_(samplenum), grid_(1), random_(seed)
+{
+	if (strategy == "random")
+		kind_ = Kind::Random;
+	else if (strategy == "sobol")
+		kind_ = Kind::Sobol;
+	else if (strategy == "hammersley")
+		kind_ = Kind::Hammersley;
+	else if (strategy == "fibonacci")
+		kind_ = Kind::Fibonacci;
+	else if (strategy == "stratified")
+	{
+		kind_ = Kind::Stratified;
+		grid_ = max(1, (int)std::sqrt(samplenum / 6.0));
+		size_t cells = 6 * (size_t)grid_ * grid_;
+		size_ = max<size_t>(1, samplenum / cells) * cells;
+	}
+	else
+		throw invalid_argument("unknown strategy: " + strategy);
+}
+
+void DirectionGenerator::Generate(size_t first, size_t n, SampleBatch& samples)const
+{
+	samples.Resize(n);
+	const double golden = (std::sqrt(5.0) - 1) / 2;
+	size_t cells = 6 * (size_t)grid_ * grid_;
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t i = first + k;
+		Vec3 p;
+		switch (kind_)
+		{
+		case Kind::Random:
+		{
+			Philox::Block u = random_(i);
+			p = SquareToSphere(Philox::Uniform(u[0]), Philox::Uniform(u[1]));
+			break;
+		}
+		case Kind::Sobol:
+			p = SquareToSphere(RadicalInverse2((uint32_t)i), Sobol2((uint32_t)i));
+			break;
+		case Kind::Hammersley:
+			p = SquareToSphere((i + 0.5f) / size_, RadicalInverse2((uint32_t)i));
+			break;
+		case Kind::Fibonacci:
+		{
+			double v = i * golden;
+			p = SquareToSphere((float)((i + 0.5) / size_), (float)(v - std::floor(v)));
+			break;
+		}
+		case Kind::Stratified:
+		{
+			// one jittered point per cell of every face per round, on the
+			// cube surface; Weight() accounts for the cube-to-sphere density
+			size_t cell = i % cells;
+			int face = (int)(cell / ((size_t)grid_ * grid_));
+			int row = (int)(cell / grid_ % grid_);
+			int col = (int)(cell % grid_);
+			Philox::Block jitter = random_(i);
+			float u = (col + Philox::Uniform(jitter[0])) / grid_;
+			float v = (row + Philox::Uniform(jitter[1])) / grid_;
+			p = CubeUV2XYZ({ face, u, v });
+			break;
+		}
+		}
+		samples.x[k] = p.x;
+		samples.y[k] = p.y;
+		samples.z[k] = p.z;
+	}
+}
+
+void DirectionGenerator::Weight(SampleBatch& samples)const
+{
+	if (kind_ != Kind::Stratified)
+		return;
+	// uniform on the cube surface has density (1+s^2+t^2)^(3/2)/24 per
+	// steradian, and the points lie on the cube so that is |p|^3/24
+	for (size_t k = 0; k < samples.Size(); k++)
+	{
+		float len2 = samples.x[k] * samples.x[k] + samples.y[k] * samples.y[k] + samples.z[k] * samples.z[k];
+		float w = 6.f / (PI * len2 * std::sqrt(len2));
+		samples.r[k] *= w;
+		samples.g[k] *= w;
+		samples.b[k] *= w;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "util.h"
+#include "philox.h"
+
+class SampleBatch;
+
+// direction sequences for Monte Carlo and quasi Monte Carlo projection.
+// direction i depends only on i, the sequence length and the seed, so ranges
+// can be generated concurrently and in any order
+class DirectionGenerator
+{
+public:
+	// random, sobol, hammersley, fibonacci, stratified
+	static const std::vector<std::string>& Strategies();
+
+	// seed only affects the random and stratified strategies
+	DirectionGenerator(const std::string& strategy, size_t samplenum, uint64_t seed = 0);
+	// number of directions in the sequence, stratified rounds samplenum down
+	// to a whole number of samples per cell
+	size_t Size()const { return size_; }
+	// writes directions [first, first+n) into samples.x/y/z
+	void Generate(size_t first, size_t n, SampleBatch& samples)const;
+	// scales the colors of non-uniformly distributed directions so that
+	// every sample keeps the 4pi/Size() weight of a uniform one
+	void Weight(SampleBatch& samples)const;
+private:
+	enum class Kind { Random, Sobol, Hammersley, Fibonacci, Stratified };
+	Kind kind_;
+	size_t size_;
+	// stratified: cells per face edge
+	int grid_;
+	Philox random_;
+};
\ No newline at end of file
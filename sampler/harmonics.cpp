@@ -1,111 +1,611 @@
 #include "util.h"
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include "basis.h"
+#include "batch.h"
+#include "cubemap.h"
 #include "harmonics.h"
+#include "basis_table.h"
+#include "panorama.h"
+#include "tiled_cubemap.h"
 
 using namespace std;
 
 Harmonics::Harmonics(int degree)
-	:degree_(degree)
+	:degree_(degree), recurrence_(degree)
 {
-	int maxfact = degree * degree;
-	factorial.resize(maxfact+1);
-	for (int i = 0; i <= maxfact; i++) 
+	if (degree < 0 || degree > MaxDegree)
+		throw invalid_argument("unsupported degree: " + to_string(degree));
+	Reset();
+}
+
+int Harmonics::MinFaceSize(int degree, float tolerance)
+{
+	if (tolerance <= 0)
+		throw invalid_argument("tolerance must be positive");
+	// a texel integrates the box filtered map against the basis taken at its
+	// center; with Y'' ~ l(l+1) Y the midpoint rule over a texel of angular
+	// size a = pi / (2 size) errs by about l(l+1) a^2 / 24 relative
+	float l = (float)max(degree, 1);
+	return max(1, (int)ceil(PI / 2 * sqrt(l * (l + 1) / (24 * tolerance))));
+}
+
+void Harmonics::Evaluate(const std::vector<Vertex>& vertices, int thread_num)
+{
+	const Vertex* data = vertices.data();
+	float scale = 4 * PI / (float)vertices.size();
+	Project(vertices.size(), thread_num, scale, PreciseLeaf, [this, data](size_t begin, size_t end, vector<Vec3>& sum) {
+		Accumulate(data + begin, data + end, sum);
+	});
+}
+
+void Harmonics::Evaluate(const SampleBatch& samples, int thread_num)
+{
+	float scale = 4 * PI / (float)samples.Size();
+	Project(samples.Size(), thread_num, scale, PreciseLeaf, [this, &samples](size_t begin, size_t end, vector<Vec3>& sum) {
+		Accumulate(samples, begin, end, sum);
+	});
+}
+
+void Harmonics::Evaluate(const SampleSource& source, size_t samplenum, int thread_num, size_t chunk_size)
+{
+	// chunk boundaries handed to source do not depend on thread_num
+	if (precise_)
+		chunk_size = min(chunk_size, PreciseLeaf);
+	size_t chunks = (samplenum + chunk_size - 1) / chunk_size;
+	float scale = 4 * PI / (float)samplenum;
+	Project(chunks, thread_num, scale, 1, [&](size_t begin, size_t end, vector<Vec3>& sum) {
+		SampleBatch samples;
+		for (size_t c = begin; c < end; c++)
+		{
+			size_t first = c * chunk_size;
+			size_t n = min(chunk_size, samplenum - first);
+			source(first, n, samples);
+			Accumulate(samples, 0, n, sum);
+		}
+	});
+}
+
+void Harmonics::Reset()
+{
+	count_ = 0;
+	sum_.assign(CoefficientNum(), array<double, 3>{ 0, 0, 0 });
+	sum_sq_.assign(CoefficientNum(), array<double, 3>{ 0, 0, 0 });
+	coefs.assign(CoefficientNum(), Vec3());
+}
+
+void Harmonics::Add(const SampleBatch& samples, int thread_num)
+{
+	int n = CoefficientNum();
+	auto moments = Sum(samples.Size(), thread_num, 2 * n, PreciseLeaf, [&](size_t begin, size_t end, vector<Vec3>& sum) {
+		AccumulateMoments(samples, begin, end, sum);
+	});
+	AddMoments(moments, samples.Size());
+}
+
+size_t Harmonics::EvaluateProgressive(const SampleSource& source, size_t max_samples, float tolerance,
+	int thread_num, size_t chunk_size)
+{
+	Reset();
+	if (precise_)
+		chunk_size = min(chunk_size, PreciseLeaf);
+	int n = CoefficientNum();
+	// rounds double in size, starting at 16 chunks, so at most half of the
+	// samples are spent past the point the target was reached
+	size_t round = 16 * chunk_size;
+	while (count_ < max_samples)
 	{
-		if (i == 0)
-			factorial[i] = 1;
-		else
-			factorial[i] = i * factorial[i - 1];
+		size_t first = count_;
+		size_t count = min(round, max_samples - first);
+		size_t chunks = (count + chunk_size - 1) / chunk_size;
+		auto moments = Sum(chunks, thread_num, 2 * n, 1, [&](size_t begin, size_t end, vector<Vec3>& sum) {
+			SampleBatch samples;
+			for (size_t c = begin; c < end; c++)
+			{
+				size_t size = min(chunk_size, count - c * chunk_size);
+				source(first + c * chunk_size, size, samples);
+				AccumulateMoments(samples, 0, size, sum);
+			}
+		});
+		AddMoments(moments, count);
+		round = count_;
+		if (Converged(tolerance))
+			break;
 	}
+	return count_;
 }
 
-void Harmonics::Evaluate(const std::vector<Vertex>& vertices)
+std::vector<Vec3> Harmonics::getStandardErrors()const
 {
-	int n = (degree_ + 1)*(degree_ + 1);
-	coefs = vector<Vec3>(n, Vec3());
-	for (const Vertex& v : vertices)
+	vector<Vec3> errors(sum_.size());
+	if (count_ < 2)
+		return errors;
+	double n = (double)count_;
+	for (size_t k = 0; k < sum_.size(); k++)
 	{
-		vector<float> Y = Basis(v.pos);
-		for (int i = 0; i < n; i++)
+		float e[3];
+		for (int c = 0; c < 3; c++)
 		{
-			coefs[i] = coefs[i] + Y[i] * v.color;
+			// per-sample estimates are 4 pi Y f
+			double mean = sum_[k][c] / n;
+			double variance = max(0.0, (sum_sq_[k][c] - n * mean * mean) / (n - 1));
+			e[c] = (float)(4 * M_PI * sqrt(variance / n));
 		}
+		errors[k] = Vec3(e[0], e[1], e[2]);
 	}
-	for (Vec3& coef : coefs)
+	return errors;
+}
+
+bool Harmonics::Converged(float tolerance)const
+{
+	if (count_ < 2)
+		return false;
+	float dc = max({ abs(coefs[0].r), abs(coefs[0].g), abs(coefs[0].b) });
+	for (const Vec3& e : getStandardErrors())
 	{
-		coef = 4*PI*coef / (float)vertices.size();
+		if (max({ e.r, e.g, e.b }) > tolerance * dc)
+			return false;
 	}
+	return true;
 }
 
-Vec3 Harmonics::Render(const Vec3& pos)
+void Harmonics::AddMoments(const std::vector<std::array<double, 3>>& moments, size_t count)
 {
-	int n = (degree_ + 1)*(degree_ + 1);
+	int n = CoefficientNum();
+	count_ += count;
+	float scale = (float)(4 * M_PI / (double)count_);
+	for (int k = 0; k < n; k++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			sum_[k][c] += moments[k][c];
+			sum_sq_[k][c] += moments[n + k][c];
+		}
+		coefs[k] = Vec3(scale * (float)sum_[k][0], scale * (float)sum_[k][1], scale * (float)sum_[k][2]);
+	}
+}
 
-	vector<float> Y = Basis(pos);
-	Vec3 color;
+void Harmonics::AccumulateMoments(const SampleBatch& samples, size_t begin, size_t end, std::vector<Vec3>& sum)const
+{
+	int n = CoefficientNum();
+	Dispatch([&](const auto& basis) {
+		AccumulateBatchMoments(basis, samples, begin, end, sum.data(), sum.data() + n);
+	});
+}
+
+void Harmonics::Integrate(const Cubemap& cubemap, int thread_num)
+{
+	int h = cubemap.Height();
+	Project(6 * h, thread_num, 1.f, 1, [this, &cubemap, h](size_t begin, size_t end, vector<Vec3>& sum) {
+		SampleBatch row;
+		for (size_t r = begin; r < end; r++)
+		{
+			cubemap.TexelRow((int)r / h, (int)r % h, row);
+			Accumulate(row, 0, row.Size(), sum);
+		}
+	});
+}
+
+void Harmonics::Integrate(const BasisTable& table, const Cubemap& cubemap, int thread_num)
+{
+	int w = cubemap.Width();
+	int h = cubemap.Height();
+	if (table.Width() != w || table.Height() != h || table.Degree() != degree_)
+		throw invalid_argument("basis table does not match the cubemap or degree");
+	int n = CoefficientNum();
+	Project(6 * h, thread_num, 1.f, 1, [&table, &cubemap, w, h, n](size_t begin, size_t end, vector<Vec3>& sum) {
+		vector<float> r(w), g(w), b(w);
+		for (size_t row = begin; row < end; row++)
+		{
+			int face = (int)row / h;
+			cubemap.RowColors(face, (int)row % h, r.data(), g.data(), b.data());
+			const float* Y = table.Row(face, (int)row % h);
+			for (int k = 0; k < n; k++, Y += w)
+			{
+				float sr = 0, sg = 0, sb = 0;
+				for (int j = 0; j < w; j++)
+				{
+					sr += Y[j] * r[j];
+					sg += Y[j] * g[j];
+					sb += Y[j] * b[j];
+				}
+				sum[k] = sum[k] + Vec3(sr, sg, sb);
+			}
+		}
+	});
+}
+
+void Harmonics::Integrate(const Panorama& panorama, int thread_num)
+{
+	int w = panorama.Width();
+	int h = panorama.Height();
+	int n = CoefficientNum();
+	// integrals of cos(m phi) and sin(m phi) over every column
+	vector<vector<float>> cos_table(degree_ + 1, vector<float>(w));
+	vector<vector<float>> sin_table(degree_ + 1, vector<float>(w));
+	for (int j = 0; j < w; j++)
+	{
+		double phi0 = 2 * M_PI * j / w - M_PI;
+		double phi1 = 2 * M_PI * (j + 1) / w - M_PI;
+		cos_table[0][j] = (float)(phi1 - phi0);
+		sin_table[0][j] = 0;
+		for (int m = 1; m <= degree_; m++)
+		{
+			cos_table[m][j] = (float)((sin(m * phi1) - sin(m * phi0)) / m);
+			sin_table[m][j] = (float)((cos(m * phi0) - cos(m * phi1)) / m);
+		}
+	}
+
+	Project(h, thread_num, 1.f, 1, [&](size_t begin, size_t end, vector<Vec3>& sum) {
+		vector<float> Y(n);
+		vector<float> colors[3] = { vector<float>(w), vector<float>(w), vector<float>(w) };
+		vector<Vec3> fc(degree_ + 1), fs(degree_ + 1);
+		for (size_t i = begin; i < end; i++)
+		{
+			// at phi = 0 the basis is P(l, m)(theta) for m >= 0 and zero below
+			double theta0 = M_PI * i / h;
+			double theta1 = M_PI * (i + 1) / h;
+			double theta = 0.5 * (theta0 + theta1);
+			Basis(Vec3((float)sin(theta), (float)cos(theta), 0.f), Y.data());
+			// exact area of the band, sin(theta) d(theta) integrated
+			float weight = (float)(cos(theta0) - cos(theta1));
+
+			panorama.RowColors((int)i, colors[0].data(), colors[1].data(), colors[2].data());
+			for (int m = 0; m <= degree_; m++)
+			{
+				float sc[3] = { 0, 0, 0 }, ss[3] = { 0, 0, 0 };
+				const float* ct = cos_table[m].data();
+				const float* st = sin_table[m].data();
+				for (int c = 0; c < 3; c++)
+				{
+					const float* f = colors[c].data();
+					for (int j = 0; j < w; j++)
+					{
+						sc[c] += f[j] * ct[j];
+						ss[c] += f[j] * st[j];
+					}
+				}
+				fc[m] = Vec3(sc[0], sc[1], sc[2]);
+				fs[m] = Vec3(ss[0], ss[1], ss[2]);
+			}
+			for (int l = 0; l <= degree_; l++)
+			{
+				int center = l * (l + 1);
+				sum[center] = sum[center] + (weight * Y[center]) * fc[0];
+				for (int m = 1; m <= l; m++)
+				{
+					float p = weight * Y[center + m];
+					sum[center + m] = sum[center + m] + p * fc[m];
+					sum[center - m] = sum[center - m] + p * fs[m];
+				}
+			}
+		}
+	});
+}
+
+void Harmonics::Integrate(const TiledCubemap& cubemap, int thread_num)
+{
+	int w = cubemap.Width();
+	int h = cubemap.Height();
+	int n = CoefficientNum();
+	vector<array<double, 3>> total(n, array<double, 3>{ 0, 0, 0 });
+	cubemap.ForEachTile([&](const TiledCubemap::Tile& tile) {
+		auto sum = Sum(tile.rows, thread_num, n, 1, [&](size_t begin, size_t end, vector<Vec3>& sum) {
+			SampleBatch row;
+			for (size_t i = begin; i < end; i++)
+			{
+				Cubemap::TexelGeometry(w, h, tile.face, tile.first_row + (int)i, row);
+				size_t offset = i * w;
+				for (int j = 0; j < w; j++)
+				{
+					row.r[j] *= tile.r[offset + j];
+					row.g[j] *= tile.g[offset + j];
+					row.b[j] *= tile.b[offset + j];
+				}
+				Accumulate(row, 0, row.Size(), sum);
+			}
+		});
+		for (int k = 0; k < n; k++)
+			for (int c = 0; c < 3; c++)
+				total[k][c] += sum[k][c];
+	}, thread_num);
+	coefs.resize(n);
+	for (int k = 0; k < n; k++)
+		coefs[k] = Vec3((float)total[k][0], (float)total[k][1], (float)total[k][2]);
+}
+
+template<typename F>
+vector<array<double, 3>> Harmonics::Sum(size_t count, int thread_num, int n, size_t leaf, F accumulate)const
+{
+	// items are summed in blocks whose size depends only on count and the
+	// block sums are merged in block order, so thread_num cannot change the
+	// rounding of the result
+	const size_t max_blocks = 1024;
+	size_t block = max<size_t>(1, (count + max_blocks - 1) / max_blocks);
+	size_t block_num = (count + block - 1) / block;
+	if (thread_num < 1)
+		thread_num = 1;
+	size_t per_thread = (block_num + thread_num - 1) / thread_num;
+
+	vector<vector<Vec3>> sums(precise_ ? 0 : block_num, vector<Vec3>(n, Vec3()));
+	vector<vector<array<double, 3>>> wide(precise_ ? block_num : 0,
+		vector<array<double, 3>>(n, array<double, 3>{ 0, 0, 0 }));
+	auto work = [&](size_t first_block, size_t last_block) {
+		vector<Vec3> leaf_sum(precise_ ? n : 0);
+		for (size_t b = first_block; b < last_block; b++)
+		{
+			if (cancelled_ && *cancelled_)
+				return;
+			size_t end = min(count, (b + 1)*block);
+			if (!precise_)
+			{
+				accumulate(b*block, end, sums[b]);
+				continue;
+			}
+			for (size_t i = b * block; i < end; i += leaf)
+			{
+				fill(leaf_sum.begin(), leaf_sum.end(), Vec3());
+				accumulate(i, min(end, i + leaf), leaf_sum);
+				for (int k = 0; k < n; k++)
+				{
+					wide[b][k][0] += leaf_sum[k].r;
+					wide[b][k][1] += leaf_sum[k].g;
+					wide[b][k][2] += leaf_sum[k].b;
+				}
+			}
+		}
+	};
+	vector<thread> workers;
+	for (int t = 0; t < thread_num; t++)
+	{
+		size_t first_block = min(block_num, t*per_thread);
+		size_t last_block = min(block_num, (t + 1)*per_thread);
+		if (t == thread_num - 1)
+			work(first_block, last_block);
+		else
+			workers.emplace_back(work, first_block, last_block);
+	}
+	for (thread& w : workers)
+		w.join();
+	if (cancelled_ && *cancelled_)
+		throw ProjectionCancelled();
+
+	vector<array<double, 3>> total(n, array<double, 3>{ 0, 0, 0 });
+	if (precise_)
+	{
+		for (const vector<array<double, 3>>& sum : wide)
+		{
+			for (int i = 0; i < n; i++)
+				for (int c = 0; c < 3; c++)
+					total[i][c] += sum[i][c];
+		}
+		return total;
+	}
+	vector<Vec3> float_total(n, Vec3());
+	for (const vector<Vec3>& sum : sums)
+	{
+		for (int i = 0; i < n; i++)
+			float_total[i] = float_total[i] + sum[i];
+	}
 	for (int i = 0; i < n; i++)
+		total[i] = { float_total[i].r, float_total[i].g, float_total[i].b };
+	return total;
+}
+
+template<typename F>
+void Harmonics::Project(size_t count, int thread_num, float scale, size_t leaf, F accumulate)
+{
+	auto sum = Sum(count, thread_num, CoefficientNum(), leaf, accumulate);
+	coefs.resize(sum.size());
+	for (size_t i = 0; i < sum.size(); i++)
+	{
+		// precise sums are scaled before rounding to float
+		if (precise_)
+			coefs[i] = Vec3((float)(scale * sum[i][0]), (float)(scale * sum[i][1]), (float)(scale * sum[i][2]));
+		else
+			coefs[i] = scale * Vec3((float)sum[i][0], (float)sum[i][1], (float)sum[i][2]);
+	}
+}
+
+template<typename F>
+void Harmonics::Dispatch(F f)const
+{
+	switch (degree_)
+	{
+	case 0: f(SHBasis<0>()); break;
+	case 1: f(SHBasis<1>()); break;
+	case 2: f(SHBasis<2>()); break;
+	case 3: f(SHBasis<3>()); break;
+	default: f(recurrence_); break;
+	}
+}
+
+void Harmonics::Accumulate(const Vertex* begin, const Vertex* end, std::vector<Vec3>& sum)const
+{
+	Dispatch([&](const auto& basis) {
+		Accumulate(basis, begin, end, sum);
+	});
+}
+
+void Harmonics::Accumulate(const SampleBatch& samples, size_t begin, size_t end, std::vector<Vec3>& sum)const
+{
+	Dispatch([&](const auto& basis) {
+		AccumulateBatch(basis, samples, begin, end, sum.data());
+	});
+}
+
+template<typename B>
+void Harmonics::Accumulate(const B& basis, const Vertex* begin, const Vertex* end, std::vector<Vec3>& sum)
+{
+	const int n = basis.Size();
+	Vec3 acc[B::MaxN];
+	float Y[B::MaxN];
+	for (const Vertex* v = begin; v != end; v++)
+	{
+		basis.Eval(v->pos, Y);
+		for (int i = 0; i < n; i++)
+		{
+			acc[i] = acc[i] + Y[i] * v->color;
+		}
+	}
+	for (int i = 0; i < n; i++)
+		sum[i] = sum[i] + acc[i];
+}
+
+Vec3 Harmonics::Render(const Vec3& pos)const
+{
+	Vec3 color;
+	Dispatch([&](const auto& basis) {
+		color = Render(basis, pos);
+	});
+	return color;
+}
+
+template<typename B>
+Vec3 Harmonics::Render(const B& basis, const Vec3& pos)const
+{
+	float Y[B::MaxN];
+	basis.Eval(pos, Y);
+	Vec3 color;
+	for (int i = 0; i < basis.Size(); i++)
 	{
 		color = color + Y[i] * coefs[i];
 	}
 	return color;
 }
 
-std::array<cv::Mat, 6> Harmonics::RenderCubemap(int width, int height)
+// unit directions of every texel of a width x height face in face-local
+// coordinates (s, t, 1)/|(s, t, 1)|; the six faces only permute and negate
+// them, so one table per resolution serves every face and every call
+struct FaceDirections
 {
-	std::array<cv::Mat, 6> imgs;
-	for (int k = 0; k < 6; k++)
+	std::vector<float> s, t, n;
+};
+
+static std::shared_ptr<const FaceDirections> GetFaceDirections(int width, int height)
+{
+	static std::mutex mutex;
+	static std::map<std::pair<int, int>, std::shared_ptr<const FaceDirections>> cache;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto& table = cache[{ width, height }];
+	if (!table)
 	{
-		imgs[k] = cv::Mat(height, width, CV_32FC3);
+		auto dirs = std::make_shared<FaceDirections>();
+		dirs->s.resize((size_t)width * height);
+		dirs->t.resize((size_t)width * height);
+		dirs->n.resize((size_t)width * height);
 		for (int i = 0; i < height; i++)
 		{
+			float t = 1.f - 2.f * i / (height - 1);
 			for (int j = 0; j < width; j++)
 			{
-				float u = (float)j / (width - 1);
-				float v = 1.f - (float)i / (height - 1);
-				Vec3 pos = CubeUV2XYZ({ k, u, v });
-				Vec3 color = Render(pos);
-				imgs[k].at<cv::Vec3f>(i, j) = { color.b, color.g, color.r };
+				float s = 2.f * j / (width - 1) - 1.f;
+				float inv = 1.f / std::sqrt(s * s + t * t + 1.f);
+				size_t k = (size_t)i * width + j;
+				dirs->s[k] = s * inv;
+				dirs->t[k] = t * inv;
+				dirs->n[k] = inv;
 			}
 		}
+		table = dirs;
 	}
-	return imgs;
+	return table;
 }
 
-vector<float> Harmonics::Basis(const Vec3& pos)
+std::array<cv::Mat, 6> Harmonics::RenderCubemap(int width, int height, bool simd, int thread_num)const
 {
-	int n = (degree_ + 1)*(degree_ + 1);
-	vector<float> Y(n);
-	Vec3 normal = Normalize(pos);
-	float x = normal.x;
-	float y = normal.y;
-	float z = normal.z;
+	const int tile_rows = 16;
+	std::array<cv::Mat, 6> imgs;
+	for (int k = 0; k < 6; k++)
+		imgs[k] = cv::Mat(height, width, CV_32FC3);
+	if (simd)
+		GetFaceDirections(width, height);
 
-	if (degree_ >= 0)
-	{
-		Y[0] = 1.f / 2.f * sqrt(1.f / PI);
-	}
-	if (degree_ >= 1)
-	{
-		Y[1] = sqrt(3.f / (4.f*PI))*z;
-		Y[2] = sqrt(3.f / (4.f*PI))*y;
-		Y[3] = sqrt(3.f / (4.f*PI))*x;
-	}
-	if (degree_ >= 2)
+	int tiles_per_face = (height + tile_rows - 1) / tile_rows;
+	atomic<int> next_tile(0);
+	auto work = [&]() {
+		for (int tile = next_tile++; tile < 6 * tiles_per_face; tile = next_tile++)
+		{
+			int face = tile / tiles_per_face;
+			int first_row = tile % tiles_per_face * tile_rows;
+			int last_row = min(height, first_row + tile_rows);
+			Dispatch([&](const auto& basis) {
+				if (simd)
+					RenderTileBatch(basis, face, first_row, last_row, imgs[face]);
+				else
+					RenderTile(basis, face, first_row, last_row, imgs[face]);
+			});
+		}
+	};
+	vector<thread> workers;
+	for (int t = 1; t < thread_num; t++)
+		workers.emplace_back(work);
+	work();
+	for (thread& w : workers)
+		w.join();
+	return imgs;
+}
+
+template<typename B>
+void Harmonics::RenderTile(const B& basis, int face, int first_row, int last_row, cv::Mat& img)const
+{
+	int width = img.cols;
+	int height = img.rows;
+	for (int i = first_row; i < last_row; i++)
 	{
-		Y[4] = 1.f / 2.f * sqrt(15.f / PI) * x * z;
-		Y[5] = 1.f / 2.f * sqrt(15.f / PI) * z * y;
-		Y[6] = 1.f / 4.f * sqrt(5.f / PI) * (-x * x - z * z + 2 * y*y);
-		Y[7] = 1.f / 2.f * sqrt(15.f / PI) * y * x;
-		Y[8] = 1.f / 4.f * sqrt(15.f / PI) * (x*x - z * z);
+		for (int j = 0; j < width; j++)
+		{
+			float u = (float)j / (width - 1);
+			float v = 1.f - (float)i / (height - 1);
+			Vec3 pos = CubeUV2XYZ({ face, u, v });
+			Vec3 color = Render(basis, pos);
+			img.at<cv::Vec3f>(i, j) = { color.b, color.g, color.r };
+		}
 	}
-	if (degree_ >= 3)
+}
+
+template<typename B>
+void Harmonics::RenderTileBatch(const B& basis, int face, int first_row, int last_row, cv::Mat& img)const
+{
+	// which of (s, t, n) and which sign CubeUV2XYZ uses for x, y, z
+	static const int axis[6][3] = { { 2, 1, 0 }, { 2, 1, 0 }, { 0, 2, 1 }, { 0, 2, 1 }, { 0, 1, 2 }, { 0, 1, 2 } };
+	static const float sign[6][3] = { { 1, 1, -1 }, { -1, 1, 1 }, { 1, 1, -1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, -1 } };
+	int width = img.cols;
+	auto dirs = GetFaceDirections(width, img.rows);
+	vector<float> x(width), y(width), z(width);
+	vector<float> r(width), g(width), b(width);
+	for (int i = first_row; i < last_row; i++)
 	{
-		Y[9] = 1.f / 4.f*sqrt(35.f / (2.f*PI))*(3 * x*x - z*z)*z;
-		Y[10] = 1.f / 2.f*sqrt(105.f / PI)*x*z*y;
-		Y[11] = 1.f / 4.f*sqrt(21.f / (2.f*PI))*z*(4 * y*y - x*x - z*z);
-		Y[12] = 1.f / 4.f*sqrt(7.f / PI)*y*(2 * y*y - 3 * x*x - 3 * z*z);
-		Y[13] = 1.f / 4.f*sqrt(21.f / (2.f*PI))*x*(4 * y*y - x*x - z*z);
-		Y[14] = 1.f / 4.f*sqrt(105.f / PI)*(x*x - z*z)*y;
-		Y[15] = 1.f / 4.f*sqrt(35.f / (2 * PI))*(x*x - 3 * z*z)*x;
+		const float* planes[3] = {
+			&dirs->s[(size_t)i * width], &dirs->t[(size_t)i * width], &dirs->n[(size_t)i * width] };
+		const float* px = planes[axis[face][0]];
+		const float* py = planes[axis[face][1]];
+		const float* pz = planes[axis[face][2]];
+		float sx = sign[face][0], sy = sign[face][1], sz = sign[face][2];
+		for (int j = 0; j < width; j++)
+		{
+			x[j] = sx * px[j];
+			y[j] = sy * py[j];
+			z[j] = sz * pz[j];
+		}
+		RenderBatch(basis, x.data(), y.data(), z.data(), width, coefs.data(),
+			r.data(), g.data(), b.data(), true);
+		cv::Vec3f* row = img.ptr<cv::Vec3f>(i);
+		for (int j = 0; j < width; j++)
+			row[j] = { b[j], g[j], r[j] };
 	}
-	return Y;
+}
+
+void Harmonics::Basis(const Vec3& pos, float* Y)const
+{
+	Dispatch([&](const auto& basis) {
+		basis.Eval(pos, Y);
+	});
 }
\ No newline at end of file
@@ -2,24 +2,130 @@
 
 #include <vector>
 #include <array>
+#include <functional>
+#include <atomic>
+#include <stdexcept>
 #include <opencv2/core.hpp>
 #include "util.h"
+#include "basis.h"
+
+class SampleBatch;
+class Cubemap;
+class BasisTable;
+class Panorama;
+class TiledCubemap;
+
+// thrown by a projection whose cancel flag was set while it ran
+class ProjectionCancelled : public std::runtime_error
+{
+public:
+	ProjectionCancelled() :std::runtime_error("projection cancelled") {}
+};
 
 class Harmonics
 {
 public:
+	static const int MaxDegree = SHRecurrence::MaxDegree;
+	// fills samples with the n samples starting at index first, called
+	// concurrently from the workers with disjoint ranges
+	typedef std::function<void(size_t first, size_t n, SampleBatch& samples)> SampleSource;
+
+	// samples per float leaf of the precise accumulation
+	static const size_t PreciseLeaf = 1024;
+
 	Harmonics(int degree);
-	void Evaluate(const std::vector<Vertex>& vertices);
+	// precise accumulation sums leaves of at most PreciseLeaf samples, or one
+	// texel row, in float and merges the leaves in double, so round-off stays
+	// near float epsilon at any sample count; streaming chunks are cut to
+	// PreciseLeaf samples. off by default, the coefficients are then summed
+	// in float blocks as before
+	void SetPrecise(bool precise) { precise_ = precise; }
+	bool Precise()const { return precise_; }
+	// once *cancelled is set the workers stop at their next block and the
+	// running projection throws ProjectionCancelled; null projects to the end
+	void SetCancel(const std::atomic<bool>* cancelled) { cancelled_ = cancelled; }
+	// samples are summed in fixed blocks spread over thread_num threads and
+	// merged in order, so every thread_num gives bitwise identical coefficients
+	void Evaluate(const std::vector<Vertex>& vertices, int thread_num = 1);
+	// same projection through the SIMD batch kernel
+	void Evaluate(const SampleBatch& samples, int thread_num = 1);
+	// deterministic projection integrating every texel once, weighted by
+	// its solid angle
+	void Integrate(const Cubemap& cubemap, int thread_num = 1);
+	// same integration with the basis values read from a precomputed table
+	// of the cubemap's face size and this degree
+	void Integrate(const BasisTable& table, const Cubemap& cubemap, int thread_num = 1);
+	// texel integration of an equirectangular panorama, separated into a
+	// per row basis factor and per column cos(m phi), sin(m phi) sums
+	void Integrate(const Panorama& panorama, int thread_num = 1);
+	// texel integration one tile at a time, each tile summed in blocks over
+	// thread_num threads and the tile sums merged in double
+	void Integrate(const TiledCubemap& cubemap, int thread_num = 1);
+	// streaming projection, samples are produced and consumed chunk_size at
+	// a time so memory stays flat whatever samplenum is
+	void Evaluate(const SampleSource& source, size_t samplenum, int thread_num = 1,
+		size_t chunk_size = 1 << 16);
+	// progressive projection: Reset, then Add chunks of uniformly weighted
+	// samples; the coefficients are the running mean after every Add and
+	// their standard errors come from the running variance, which assumes
+	// independent samples and so overestimates the error of sobol
+	void Reset();
+	void Add(const SampleBatch& samples, int thread_num = 1);
+	size_t SampleCount()const { return count_; }
+	std::vector<Vec3> getStandardErrors()const;
+	// every standard error is within tolerance times the largest DC channel
+	bool Converged(float tolerance)const;
+	// draws samples from source in doubling rounds until Converged(tolerance)
+	// or max_samples; source must be usable for any prefix of max_samples.
+	// returns the samples used
+	size_t EvaluateProgressive(const SampleSource& source, size_t max_samples, float tolerance,
+		int thread_num = 1, size_t chunk_size = 1 << 14);
 	std::vector<Vec3> getCoefficients()const
 	{
 		return coefs;
 	}
-	Vec3 Render(const Vec3& pos);
-	std::array<cv::Mat, 6> RenderCubemap(int width, int height);
+	int Degree()const { return degree_; }
+	int CoefficientNum()const { return (degree_ + 1)*(degree_ + 1); }
+	// smallest face size whose texel integration keeps the relative
+	// coefficient error of degree within tolerance
+	static int MinFaceSize(int degree, float tolerance);
+	Vec3 Render(const Vec3& pos)const;
+	// faces are cut into row tiles rendered by thread_num threads
+	std::array<cv::Mat, 6> RenderCubemap(int width, int height, bool simd = true, int thread_num = 1)const;
+	// Y must hold CoefficientNum() floats
+	void Basis(const Vec3& pos, float* Y)const;
 private:
 	int degree_;
+	bool precise_ = false;
+	const std::atomic<bool>* cancelled_ = nullptr;
 	std::vector<Vec3> coefs;
+	// evaluates the degrees that have no SHBasis specialization
+	SHRecurrence recurrence_;
+
+	// running sums of the progressive projection
+	size_t count_ = 0;
+	std::vector<std::array<double, 3>> sum_, sum_sq_;
 
-	std::vector<float> Basis(const Vec3& pos);
-	std::vector<float> factorial;
+	// sums of n values per item over count items, in fixed blocks; when
+	// precise_ a block is accumulated leaf items at a time
+	template<typename F>
+	std::vector<std::array<double, 3>> Sum(size_t count, int thread_num, int n, size_t leaf, F accumulate)const;
+	template<typename F>
+	void Project(size_t count, int thread_num, float scale, size_t leaf, F accumulate);
+	// calls f with SHBasis<degree_>, or with recurrence_ above degree 3
+	template<typename F>
+	void Dispatch(F f)const;
+	void Accumulate(const SampleBatch& samples, size_t begin, size_t end, std::vector<Vec3>& sum)const;
+	void Accumulate(const Vertex* begin, const Vertex* end, std::vector<Vec3>& sum)const;
+	// sums into sum[0..n) and squares into sum[n..2n)
+	void AccumulateMoments(const SampleBatch& samples, size_t begin, size_t end, std::vector<Vec3>& sum)const;
+	void AddMoments(const std::vector<std::array<double, 3>>& moments, size_t count);
+	template<typename B>
+	static void Accumulate(const B& basis, const Vertex* begin, const Vertex* end, std::vector<Vec3>& sum);
+	template<typename B>
+	Vec3 Render(const B& basis, const Vec3& pos)const;
+	template<typename B>
+	void RenderTile(const B& basis, int face, int first_row, int last_row, cv::Mat& img)const;
+	template<typename B>
+	void RenderTileBatch(const B& basis, int face, int first_row, int last_row, cv::Mat& img)const;
 };
\ No newline at end of file
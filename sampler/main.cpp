@@ -5,8 +5,23 @@
 #include <sstream>
 #include <stdexcept>
 #include <map>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <atomic>
 #include "cubemap.h"
 #include "harmonics.h"
+#include "batch.h"
+#include "generator.h"
+#include "basis_table.h"
+#include "coef_pack.h"
+#include "panorama.h"
+#include "tiled_cubemap.h"
+#include "result_cache.h"
+#include "spool.h"
 
 using namespace std;
 
@@ -20,69 +35,217 @@ std::string CoefficientsString(const std::vector<Vec3>& coefs)
 	return oss.str();
 }
 
-int main(int argc, char* argv[])
+void PrintThroughput(const std::string& kernel, size_t samplenum, chrono::steady_clock::time_point start)
 {
-	int degree = 3;
-	int samplenum = 1000000;
-	// read arguments
-	if (argc <3 || argc > 6)
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "evaluate (" << kernel << "): " << seconds * 1000 << " ms, "
+		<< samplenum / seconds << " samples/s" << endl;
+}
+
+bool IsStrategy(const std::string& strategy)
+{
+	auto& names = DirectionGenerator::Strategies();
+	return strategy == "texel" || find(names.begin(), names.end(), strategy) != names.end();
+}
+
+// streams samplenum directions of strategy through the SIMD kernel, or
+// integrates the texels; returns the number of samples used. Env is a
+// Cubemap or a Panorama
+template<typename Env>
+size_t Project(Harmonics& harmonics, const Env& env, const std::string& strategy,
+	size_t samplenum, uint64_t seed, int threadnum)
+{
+	if (strategy == "texel")
 	{
-		cout << "Usage: ./sampler directory format [degree samplenum --write-rendered]" << endl;
-		return 1;
+		harmonics.Integrate(env, threadnum);
+		return env.TexelNum();
+	}
+	DirectionGenerator generator(strategy, samplenum, seed);
+	harmonics.Evaluate([&](size_t first, size_t n, SampleBatch& samples) {
+		generator.Generate(first, n, samples);
+		env.Sample(samples);
+		generator.Weight(samples);
+	}, generator.Size(), threadnum);
+	return generator.Size();
+}
+
+// rms coefficient error of every strategy at growing sample counts, against
+// the texel integration of the same environment
+template<typename Env>
+void PrintConvergence(const Env& env, int degree, size_t samplenum, uint64_t seed, int threadnum)
+{
+	Harmonics reference(degree);
+	reference.Integrate(env, threadnum);
+	auto expected = reference.getCoefficients();
+
+	cout << "strategy\tsamples\trms_error" << endl;
+	for (const string& strategy : DirectionGenerator::Strategies())
+	{
+		for (size_t n = 100; n <= samplenum; n *= 10)
+		{
+			Harmonics harmonics(degree);
+			size_t used = Project(harmonics, env, strategy, n, seed, threadnum);
+			auto coefs = harmonics.getCoefficients();
+			double error = 0;
+			for (size_t i = 0; i < coefs.size(); i++)
+			{
+				Vec3 d = coefs[i] - expected[i];
+				error += d.r * d.r + d.g * d.g + d.b * d.b;
+			}
+			cout << strategy << "\t" << used << "\t" << sqrt(error / (3 * coefs.size())) << endl;
+		}
 	}
+}
 
-	string dir = argv[1];
+struct Options
+{
+	string format;
+	int degree = 3;
+	size_t samplenum = 1000000;
+	int threadnum = max(1, (int)thread::hardware_concurrency());
+	bool write_rendered = false;
+	bool convergence = false;
+	string kernel = "simd";
+	string strategy = "random";
+	uint64_t seed = 0;
+	string basis_cache;
+	// texel storage of the decoded faces, one of StorageNames
+	string storage = "float";
+	// relative coefficient error allowed when decoding at reduced size, 0 decodes full size
+	float tolerance = 0;
+	// coefficient pack written instead of coefficients.txt
+	string pack;
+	// environments are a single equirectangular panorama.<format>
+	bool panorama = false;
+	// stops sampling once every coefficient's standard error is within
+	// target_error times the DC coefficient, samplenum becomes the budget
+	float target_error = 0;
+	// double merged accumulation for reference bakes of 10^8 samples and up
+	bool precise = false;
+	// bytes of texels held at once by the out-of-core texel integration,
+	// 0 keeps the whole cubemap resident
+	size_t tile_budget = 0;
+	// samples every environment again instead of reusing coefficients.cache
+	bool force = false;
+	// stops the projection of a spool job, which then writes nothing
+	const atomic<bool>* cancelled = nullptr;
+};
+
+string DirectoryPath(string dir)
+{
 	if (dir.back() != '/' && dir.back() != '\\')
 		dir += '/';
-	array<string, 6> faces = {"posx", "negx", "posy", "negy", "posz", "negz"};
+	return dir;
+}
+
+// names of the Cubemap::Storage values in order
+const array<string, 4> StorageNames = { "float", "8bit", "planar8", "half" };
+
+const array<string, 6> FaceNames = { "posx", "negx", "posy", "negy", "posz", "negz" };
+
+array<string, 6> FaceFiles(const std::string& dir, const std::string& format)
+{
 	array<std::string, 6> img_files;
-	string format = argv[2];
 	for (int i = 0; i < 6; i++)
-		img_files[i] = dir + faces[i] + "." + format;
+		img_files[i] = dir + FaceNames[i] + "." + format;
+	return img_files;
+}
 
-	bool write_rendered = false;
-	if (argc >= 4)
-		degree = stoi(argv[3]);
-	if(argc >= 5)
-		samplenum = stoi(argv[4]);
-	if (argc >= 6 && string(argv[5]) == "--write-rendered")
-		write_rendered = true;
-
-	// output directory
-	string outdir = dir + "output-images/";
-	if (write_rendered)
-	{
-		string mkdircmd = "mkdir " + outdir;
-		replace(mkdircmd.begin(), mkdircmd.end(), '/', '\\');
-		system(mkdircmd.c_str());
-	}
+// last component of a directory path, the environment's name in a pack
+string EnvironmentName(const std::string& dir)
+{
+	size_t end = dir.find_last_not_of("/\\");
+	if (end == string::npos)
+		return dir;
+	size_t begin = dir.find_last_of("/\\", end);
+	begin = begin == string::npos ? 0 : begin + 1;
+	return dir.substr(begin, end - begin + 1);
+}
 
-	try {
+vector<string> SourceFiles(const std::string& dir, const Options& opt)
+{
+	if (opt.panorama)
+		return { dir + "panorama." + opt.format };
+	array<string, 6> faces = FaceFiles(dir, opt.format);
+	return vector<string>(faces.begin(), faces.end());
+}
 
-		// sampling
-		cout << "reading cubemap ..." << endl;
-		Cubemap cubemap(img_files);
-		if(write_rendered)
-		{
-			string expandfile = outdir + "expand." + format;
-			cout << "write expand cubemap image: " << expandfile << endl;
-			cv::Mat expand = cubemap.GenExpandImage();
-			cv::imwrite(expandfile, expand * 255);
-		}
+// one decoded environment, either six faces or a panorama, or six faces
+// read a tile at a time
+struct Environment
+{
+	unique_ptr<Cubemap> cubemap;
+	unique_ptr<Panorama> panorama;
+	unique_ptr<TiledCubemap> tiled;
+	// coefficients.cache of the directory, unused with --convergence
+	unique_ptr<ResultCache> cache;
+	// set when the cache is valid, nothing is decoded then
+	bool cached = false;
+	vector<Vec3> coefs;
+	size_t samples = 0;
+};
+
+// every option that changes the coefficients, the thread count does not
+string CacheParams(const Options& opt)
+{
+	ostringstream params;
+	params << "format=" << opt.format << " degree=" << opt.degree << " samplenum=" << opt.samplenum
+		<< " strategy=" << opt.strategy << " seed=" << opt.seed << " kernel=" << opt.kernel
+		<< " storage=" << opt.storage << " tolerance=" << opt.tolerance << " panorama=" << opt.panorama
+		<< " target_error=" << opt.target_error << " precise=" << opt.precise
+		<< " tile_budget=" << opt.tile_budget << " rendered=" << opt.write_rendered;
+	return params.str();
+}
 
-		Harmonics harmonics(degree);
+Environment ReadEnvironment(const std::string& dir, const Options& opt)
+{
+	Environment env;
+	env.cache.reset(new ResultCache(dir + "coefficients.cache", CacheParams(opt), SourceFiles(dir, opt)));
+	if (!opt.convergence)
+	{
+		if (!opt.force && env.cache->Lookup(env.coefs, env.samples))
 		{
-			cout << "sampling ..." << endl;
-			auto verticies = cubemap.RandomSample(samplenum);
-			harmonics.Evaluate(verticies);
+			env.cached = true;
+			return env;
 		}
+		// hashed before decoding, so the cache describes the files that were read
+		env.cache->Hash();
+	}
+	if (opt.panorama)
+	{
+		env.panorama.reset(new Panorama(dir + "panorama." + opt.format));
+		return env;
+	}
+	array<std::string, 6> img_files = FaceFiles(dir, opt.format);
+	if (opt.tile_budget > 0)
+	{
+		env.tiled.reset(new TiledCubemap(img_files, opt.tile_budget));
+		return env;
+	}
+	int min_size = opt.tolerance > 0 ? Harmonics::MinFaceSize(opt.degree, opt.tolerance) : 0;
+	auto storage = find(StorageNames.begin(), StorageNames.end(), opt.storage) - StorageNames.begin();
+	env.cubemap.reset(new Cubemap(img_files, (Cubemap::Storage)storage, min_size));
+	return env;
+}
 
-		cout << "---------- coefficients ----------" << endl;
-		auto coefs = harmonics.getCoefficients();
-		string coefstr = CoefficientsString(coefs);
-		cout << coefstr;
-		cout << "----------------------------------" << endl;
+// prints the coefficients and writes them into dir, or adds them to pack
+void WriteCoefficients(const Options& opt, const std::string& dir, const vector<Vec3>& coefs,
+	size_t used, ResultCache& cache, CoefPackWriter* pack)
+{
+	cout << "---------- coefficients ----------" << endl;
+	string coefstr = CoefficientsString(coefs);
+	cout << coefstr;
+	cout << "----------------------------------" << endl;
 
+	if (pack)
+	{
+		vector<float> rgb;
+		for (const Vec3& c : coefs)
+			rgb.insert(rgb.end(), { c.r, c.g, c.b });
+		pack->Add(EnvironmentName(dir), opt.degree, used, cache.Hash(), rgb.data());
+	}
+	else
+	{
 		ofstream coeffile(dir + "coefficients.txt");
 		if (coeffile)
 		{
@@ -91,27 +254,469 @@ int main(int argc, char* argv[])
 		}
 		else
 			cout << "write coefficients.txt failed" << endl;
+	}
+}
+
+// writes the outputs of freshly sampled coefficients and records them in the cache
+void WriteResult(const Options& opt, const std::string& dir, const Harmonics& harmonics,
+	size_t used, ResultCache& cache, CoefPackWriter* pack)
+{
+	auto coefs = harmonics.getCoefficients();
+	WriteCoefficients(opt, dir, coefs, used, cache, pack);
+	cache.Store(coefs, used);
+}
+
+void WriteExpand(const Options& opt, const std::string& outdir, const Cubemap& cubemap)
+{
+	string expandfile = outdir + "expand." + opt.format;
+	cout << "write expand cubemap image: " << expandfile << endl;
+	cv::Mat expand = cubemap.GenExpandImage();
+	cv::imwrite(expandfile, expand * 255);
+}
+
+// renders the coefficients into cubemap faces of the given size
+void WriteRendered(const Options& opt, const std::string& outdir, const Harmonics& harmonics,
+	int width, int height)
+{
+	cout << "rendering ..." << endl;
+	auto shimgs = harmonics.RenderCubemap(width, height, opt.kernel != "scalar", opt.threadnum);
+
+	for (int i = 0; i < 6; i++)
+	{
+		string outfile = outdir + "rendered_" + FaceNames[i] + "." + opt.format;
+		cout << "write rendered images: " << outfile << endl;
+		cv::imwrite(outfile, shimgs[i] * 255);
+	}
+	Cubemap shcubemap(shimgs);
+
+	string shexpandfile = outdir + "rendered_expand." + opt.format;
+	cout << "write rendered expand cubemap image: " << shexpandfile << endl;
+	cv::Mat shexpand = shcubemap.GenExpandImage();
+	cv::imwrite(shexpandfile, shexpand * 255);
+}
+
+void MakeDirectory(string dir)
+{
+	string mkdircmd = "mkdir " + dir;
+	replace(mkdircmd.begin(), mkdircmd.end(), '/', '\\');
+	system(mkdircmd.c_str());
+}
+
+// samples until opt.target_error is reached or samplenum is spent, returns
+// the samples used. Env is a Cubemap or a Panorama
+template<typename Env>
+size_t ProjectProgressive(Harmonics& harmonics, const Env& env, const Options& opt)
+{
+	cout << "sampling (" << opt.strategy << ", target error " << opt.target_error << ") ..." << endl;
+	auto start = chrono::steady_clock::now();
+	DirectionGenerator generator(opt.strategy, opt.samplenum, opt.seed);
+	size_t used = harmonics.EvaluateProgressive([&](size_t first, size_t n, SampleBatch& samples) {
+		generator.Generate(first, n, samples);
+		env.Sample(samples);
+	}, generator.Size(), opt.target_error, opt.threadnum);
+	PrintThroughput(string(Pack::Name()) + " progressive", used, start);
+	auto errors = harmonics.getStandardErrors();
+	float worst = 0;
+	for (const Vec3& e : errors)
+		worst = max({ worst, e.r, e.g, e.b });
+	cout << used << " of " << generator.Size() << " samples, largest standard error " << worst << endl;
+	return used;
+}
+
+// projects one environment and writes its outputs into dir, or adds its
+// coefficients to pack
+void ProcessCubemap(const Options& opt, const std::string& dir, const Cubemap& decoded,
+	ResultCache& cache, CoefPackWriter* pack)
+{
+	const string& strategy = opt.strategy;
+	int threadnum = opt.threadnum;
+	cout << "cubemap faces: " << decoded.Width() << "x" << decoded.Height()
+		<< ", " << decoded.TexelBytes() / (1 << 20) << " MB" << endl;
+
+	// output directory, filled once the projection is done so a cancelled
+	// one leaves it untouched
+	string outdir = dir + "output-images/";
+
+	// the projection reads the coarsest mip level the tolerance allows
+	Cubemap cubemap = decoded;
+	if (opt.tolerance > 0)
+	{
+		cubemap = decoded.MipLevel(Harmonics::MinFaceSize(opt.degree, opt.tolerance), threadnum);
+		cout << "projecting mip level: " << cubemap.Width() << "x" << cubemap.Height() << endl;
+	}
 
+	if (opt.convergence)
+	{
+		if (opt.write_rendered)
+		{
+			MakeDirectory(outdir);
+			WriteExpand(opt, outdir, decoded);
+		}
+		PrintConvergence(cubemap, opt.degree, opt.samplenum, opt.seed, threadnum);
+		return;
+	}
+
+	Harmonics harmonics(opt.degree);
+	harmonics.SetPrecise(opt.precise);
+	harmonics.SetCancel(opt.cancelled);
+	size_t used = 0;
+	if (strategy == "texel" && !opt.basis_cache.empty())
+	{
+		cout << "loading basis table ..." << endl;
+		auto start = chrono::steady_clock::now();
+		auto table = BasisTable::Load(opt.basis_cache, cubemap.Width(), cubemap.Height(), opt.degree, threadnum);
+		cout << "basis table: " << chrono::duration<double>(chrono::steady_clock::now() - start).count() * 1000
+			<< " ms" << endl;
+		cout << "sampling (texel, cached basis) ..." << endl;
+		start = chrono::steady_clock::now();
+		harmonics.Integrate(*table, cubemap, threadnum);
+		used = cubemap.TexelNum();
+		PrintThroughput("table", used, start);
+	}
+	else if (opt.target_error > 0)
+		used = ProjectProgressive(harmonics, cubemap, opt);
+	else if (opt.kernel == "simd" || strategy == "texel")
+	{
+		cout << "sampling (" << strategy << ") ..." << endl;
+		auto start = chrono::steady_clock::now();
+		used = Project(harmonics, cubemap, strategy, opt.samplenum, opt.seed, threadnum);
+		PrintThroughput(string(Pack::Name()) + " streaming", used, start);
+	}
+	else
+	{
+		// the comparison kernels need every sample up front
+		cout << "sampling (" << strategy << ") ..." << endl;
+		DirectionGenerator generator(strategy, opt.samplenum, opt.seed);
+		SampleBatch batch;
+		generator.Generate(0, generator.Size(), batch);
+		cubemap.Sample(batch);
+		generator.Weight(batch);
+		auto verticies = batch.Vertices();
+		used = verticies.size();
 
-		if(write_rendered)
+		auto start = chrono::steady_clock::now();
+		harmonics.Evaluate(verticies, threadnum);
+		PrintThroughput("scalar", verticies.size(), start);
+		if (opt.kernel == "both")
 		{
-			cout << "rendering ..." << endl;
-			auto shimgs = harmonics.RenderCubemap(cubemap.Width(), cubemap.Height());
+			start = chrono::steady_clock::now();
+			harmonics.Evaluate(batch, threadnum);
+			PrintThroughput(Pack::Name(), batch.Size(), start);
+		}
+	}
 
-			for (int i = 0; i < 6; i++)
-			{
-				string outfile = outdir + "rendered_" + faces[i] + "." + format;
-				cout << "write rendered images: " << outfile << endl;
-				cv::imwrite(outfile, shimgs[i] * 255);
-			}
-			Cubemap shcubemap(shimgs);
+	WriteResult(opt, dir, harmonics, used, cache, pack);
+	if (opt.write_rendered)
+	{
+		MakeDirectory(outdir);
+		WriteExpand(opt, outdir, decoded);
+		WriteRendered(opt, outdir, harmonics, decoded.Width(), decoded.Height());
+	}
+}
+
+// panorama counterpart of ProcessCubemap, the basis cache, mip and 8-bit
+// options apply to cubemaps only
+void ProcessPanorama(const Options& opt, const std::string& dir, const Panorama& panorama,
+	ResultCache& cache, CoefPackWriter* pack)
+{
+	cout << "panorama: " << panorama.Width() << "x" << panorama.Height() << endl;
+	if (opt.convergence)
+	{
+		PrintConvergence(panorama, opt.degree, opt.samplenum, opt.seed, opt.threadnum);
+		return;
+	}
+
+	Harmonics harmonics(opt.degree);
+	harmonics.SetPrecise(opt.precise);
+	harmonics.SetCancel(opt.cancelled);
+	size_t used = 0;
+	if (opt.target_error > 0)
+		used = ProjectProgressive(harmonics, panorama, opt);
+	else
+	{
+		cout << "sampling (" << opt.strategy << ") ..." << endl;
+		auto start = chrono::steady_clock::now();
+		used = Project(harmonics, panorama, opt.strategy, opt.samplenum, opt.seed, opt.threadnum);
+		PrintThroughput(opt.strategy == "texel" ? string("separable") : string(Pack::Name()) + " streaming", used, start);
+	}
+
+	WriteResult(opt, dir, harmonics, used, cache, pack);
+	if (opt.write_rendered)
+	{
+		string outdir = dir + "output-images/";
+		MakeDirectory(outdir);
+		WriteRendered(opt, outdir, harmonics, panorama.Height() / 2, panorama.Height() / 2);
+	}
+}
+
+// out-of-core texel integration, peak memory is one tile of texels plus a
+// decoded face for jpeg; the rendering is at most 1024 wide for the same reason
+void ProcessTiled(const Options& opt, const std::string& dir, const TiledCubemap& cubemap,
+	ResultCache& cache, CoefPackWriter* pack)
+{
+	cout << "cubemap faces: " << cubemap.Width() << "x" << cubemap.Height()
+		<< ", tiles of " << cubemap.TileRows() << " rows" << endl;
+	Harmonics harmonics(opt.degree);
+	harmonics.SetPrecise(opt.precise);
+	harmonics.SetCancel(opt.cancelled);
+	cout << "sampling (texel, tiled) ..." << endl;
+	auto start = chrono::steady_clock::now();
+	harmonics.Integrate(cubemap, opt.threadnum);
+	PrintThroughput("tiled", cubemap.TexelNum(), start);
+
+	WriteResult(opt, dir, harmonics, cubemap.TexelNum(), cache, pack);
+	if (opt.write_rendered)
+	{
+		string outdir = dir + "output-images/";
+		MakeDirectory(outdir);
+		int size = min(cubemap.Width(), 1024);
+		WriteRendered(opt, outdir, harmonics, size, size);
+	}
+}
+
+void ProcessEnvironment(const Options& opt, const std::string& dir, const Environment& env,
+	CoefPackWriter* pack)
+{
+	if (env.cached)
+	{
+		cout << "sources unchanged, " << env.samples << " samples from " << dir << "coefficients.cache" << endl;
+		WriteCoefficients(opt, dir, env.coefs, env.samples, *env.cache, pack);
+	}
+	else if (env.panorama)
+		ProcessPanorama(opt, dir, *env.panorama, *env.cache, pack);
+	else if (env.tiled)
+		ProcessTiled(opt, dir, *env.tiled, *env.cache, pack);
+	else
+		ProcessCubemap(opt, dir, *env.cubemap, *env.cache, pack);
+}
+
+// directories listed one per line in manifest, "-" reads them from stdin
+vector<string> ReadManifest(const std::string& manifest)
+{
+	ifstream file;
+	if (manifest != "-")
+	{
+		file.open(manifest);
+		if (!file)
+			throw runtime_error("cannot open " + manifest);
+	}
+	istream& in = manifest == "-" ? cin : file;
+	vector<string> dirs;
+	string line;
+	while (getline(in, line))
+	{
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (!line.empty() && line[0] != '#')
+			dirs.push_back(DirectoryPath(line));
+	}
+	return dirs;
+}
 
-			string shexpandfile = outdir + "rendered_expand." + format;
-			cout << "write rendered expand cubemap image: " << shexpandfile << endl;
-			cv::Mat shexpand = shcubemap.GenExpandImage();
-			cv::imwrite(shexpandfile, shexpand * 255);
+// the next environment is decoded on its own thread while the current one
+// is projected, so decoding hides behind sampling
+int ProcessBatch(const Options& opt, const vector<string>& dirs)
+{
+	int failed = 0;
+	unique_ptr<CoefPackWriter> pack;
+	if (!opt.pack.empty())
+		pack.reset(new CoefPackWriter());
+	auto read = [&opt](const string& dir) { return ReadEnvironment(dir, opt); };
+	future<Environment> next;
+	if (!dirs.empty())
+		next = async(launch::async, read, dirs[0]);
+	for (size_t i = 0; i < dirs.size(); i++)
+	{
+		cout << "===== processing " << dirs[i] << " =====" << endl;
+		auto current = move(next);
+		if (i + 1 < dirs.size())
+			next = async(launch::async, read, dirs[i + 1]);
+		try {
+			ProcessEnvironment(opt, dirs[i], current.get(), pack.get());
+		}
+		catch (const std::exception& e)
+		{
+			cout << "***** AN ERROR OCCURRED *****" << endl;
+			cout << e.what() << endl;
+			failed++;
 		}
+	}
+	// environments of other runs, and failed ones, keep their entries
+	if (pack)
+	{
+		pack->Merge(opt.pack);
+		pack->Write(opt.pack);
+		cout << "written " << opt.pack << endl;
+	}
+	cout << dirs.size() - failed << " of " << dirs.size() << " environments done" << endl;
+	return failed == 0 ? 0 : 1;
+}
 
+// options of one spool job, its fields override the service's options
+Options JobOptions(const SpoolService::Job& job, const Options& service)
+{
+	Options opt = service;
+	for (const auto& field : job.fields)
+	{
+		const string& key = field.first;
+		const string& value = field.second;
+		if (key == "format")
+			opt.format = value;
+		else if (key == "degree")
+			opt.degree = stoi(value);
+		else if (key == "samplenum")
+			opt.samplenum = stoull(value);
+		else if (key == "strategy")
+			opt.strategy = value;
+		else if (key == "seed")
+			opt.seed = stoull(value);
+		else if (key == "pack")
+			opt.pack = value;
+		else if (key != "dir")
+			throw runtime_error("unknown job field " + key);
+	}
+	if (job.fields.count("dir") == 0)
+		throw runtime_error("job has no dir");
+	if (!IsStrategy(opt.strategy)
+		|| (opt.target_error > 0 && opt.strategy != "random" && opt.strategy != "sobol")
+		|| (opt.tile_budget > 0 && (opt.strategy != "texel" || opt.panorama)))
+		throw runtime_error("strategy " + opt.strategy + " does not fit the service options");
+	return opt;
+}
+
+// environments registered as jobs in spool are projected by workers jobs at
+// a time, each sampling with its share of the threads
+int RunService(const Options& opt, const std::string& spool, int workers)
+{
+	Options service = opt;
+	service.threadnum = max(1, opt.threadnum / workers);
+	// jobs may share a pack, each merges its entry into the pack on disk
+	// under this lock so no job drops another's entry
+	mutex pack_mutex;
+	auto run = [&service, &pack_mutex](const SpoolService::Job& job, const atomic<bool>& cancelled,
+		const SpoolService::Progress& progress)
+	{
+		Options opt = JobOptions(job, service);
+		opt.cancelled = &cancelled;
+		string dir = DirectoryPath(job.fields.at("dir"));
+		progress("reading");
+		Environment env = ReadEnvironment(dir, opt);
+		if (cancelled)
+			return;
+		progress(env.cached ? "unchanged" : "sampling");
+		if (opt.pack.empty())
+			ProcessEnvironment(opt, dir, env, nullptr);
+		else
+		{
+			CoefPackWriter pack;
+			ProcessEnvironment(opt, dir, env, &pack);
+			lock_guard<mutex> lock(pack_mutex);
+			pack.Merge(opt.pack);
+			pack.Write(opt.pack);
+		}
+	};
+	auto sources = [&service](const SpoolService::Job& job)
+	{
+		return SourceFiles(DirectoryPath(job.fields.at("dir")), JobOptions(job, service));
+	};
+	SpoolService(DirectoryPath(spool), workers, run, sources).Run(chrono::milliseconds(500));
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	string manifest;
+	string spool;
+	int workers = 1;
+	// read arguments
+	vector<string> args;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--write-rendered")
+			opt.write_rendered = true;
+		else if (arg == "--convergence")
+			opt.convergence = true;
+		else if (arg == "--threads" && i + 1 < argc)
+			opt.threadnum = max(1, stoi(argv[++i]));
+		else if (arg == "--kernel" && i + 1 < argc)
+			opt.kernel = argv[++i];
+		else if (arg == "--strategy" && i + 1 < argc)
+			opt.strategy = argv[++i];
+		else if (arg == "--seed" && i + 1 < argc)
+			opt.seed = stoull(argv[++i]);
+		else if (arg == "--basis-cache" && i + 1 < argc)
+			opt.basis_cache = argv[++i];
+		else if (arg == "--tolerance" && i + 1 < argc)
+			opt.tolerance = stof(argv[++i]);
+		else if (arg == "--8bit")
+			opt.storage = "8bit";
+		else if (arg == "--storage" && i + 1 < argc)
+			opt.storage = argv[++i];
+		else if (arg == "--pack" && i + 1 < argc)
+			opt.pack = argv[++i];
+		else if (arg == "--target-error" && i + 1 < argc)
+			opt.target_error = stof(argv[++i]);
+		else if (arg == "--panorama")
+			opt.panorama = true;
+		else if (arg == "--force")
+			opt.force = true;
+		else if (arg == "--precise")
+			opt.precise = true;
+		else if (arg == "--tile-budget" && i + 1 < argc)
+			opt.tile_budget = stoull(argv[++i]) << 20;
+		else if (arg == "--batch" && i + 1 < argc)
+			manifest = argv[++i];
+		else if (arg == "--watch" && i + 1 < argc)
+			spool = argv[++i];
+		else if (arg == "--workers" && i + 1 < argc)
+			workers = max(1, stoi(argv[++i]));
+		else
+			args.push_back(arg);
+	}
+	// in batch and watch mode the manifest or spool takes the place of the directory
+	size_t first = manifest.empty() && spool.empty() ? 1 : 0;
+	if (args.size() < first + 1 || args.size() > first + 3
+		|| (opt.kernel != "scalar" && opt.kernel != "simd" && opt.kernel != "both")
+		|| !IsStrategy(opt.strategy)
+		|| find(StorageNames.begin(), StorageNames.end(), opt.storage) == StorageNames.end()
+		|| (opt.target_error > 0 && ((opt.strategy != "random" && opt.strategy != "sobol") || opt.kernel != "simd"))
+		|| (opt.tile_budget > 0 && (opt.strategy != "texel" || opt.panorama))
+		|| (!spool.empty() && (!manifest.empty() || opt.convergence)))
+	{
+		cout << "Usage: ./sampler directory format [degree samplenum] [--threads N] "
+			"[--kernel scalar|simd|both] [--strategy random|sobol|hammersley|fibonacci|stratified|texel] "
+			"[--seed N] [--basis-cache DIR] [--8bit] [--storage float|8bit|planar8|half] [--tolerance T] [--pack FILE] [--panorama] [--target-error T] [--precise] [--tile-budget MB] [--write-rendered] [--convergence] [--force]" << endl;
+		cout << "       ./sampler --batch manifest format [degree samplenum] [options]" << endl;
+		cout << "       ./sampler --watch spool format [degree samplenum] [--workers N] [options]" << endl;
+		return 1;
+	}
+
+	opt.format = args[first];
+	if (args.size() >= first + 2)
+		opt.degree = stoi(args[first + 1]);
+	if (args.size() >= first + 3)
+		opt.samplenum = stoull(args[first + 2]);
+
+	try {
+		if (!manifest.empty())
+			return ProcessBatch(opt, ReadManifest(manifest));
+		if (!spool.empty())
+			return RunService(opt, spool, workers);
+
+		string dir = DirectoryPath(args[0]);
+		cout << (opt.panorama ? "reading panorama ..." : "reading cubemap ...") << endl;
+		Environment env = ReadEnvironment(dir, opt);
+		if (opt.pack.empty())
+			ProcessEnvironment(opt, dir, env, nullptr);
+		else
+		{
+			CoefPackWriter pack;
+			ProcessEnvironment(opt, dir, env, &pack);
+			pack.Merge(opt.pack);
+			pack.Write(opt.pack);
+			cout << "written " << opt.pack << endl;
+		}
 		cout << "done !" << endl;
 	}
 	catch (std::exception e)
@@ -0,0 +1,78 @@
+#include <stdexcept>
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename)
+{
+	file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("open " + filename + " failed");
+	LARGE_INTEGER size;
+	GetFileSizeEx(file_, &size);
+	size_ = (size_t)size.QuadPart;
+	if (size_ == 0)
+		return;
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_)
+		data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+	if (!data_)
+	{
+		if (mapping_)
+			CloseHandle(mapping_);
+		CloseHandle(file_);
+		throw std::runtime_error("map " + filename + " failed");
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_)
+		UnmapViewOfFile(data_);
+	if (mapping_)
+		CloseHandle(mapping_);
+	CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("open " + filename + " failed");
+	struct stat st;
+	fstat(fd, &st);
+	size_ = (size_t)st.st_size;
+	if (size_ > 0)
+	{
+		void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+		{
+			close(fd);
+			throw std::runtime_error("map " + filename + " failed");
+		}
+		data_ = (const char*)p;
+	}
+	close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_)
+		munmap((void*)data_, size_);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+	const char* Data()const { return data_; }
+	size_t Size()const { return size_; }
+private:
+	MappedFile(const MappedFile&) = delete;
+	void operator=(const MappedFile&) = delete;
+
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
\ No newline at end of file
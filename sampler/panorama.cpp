@@ -0,0 +1,58 @@
+#include "util.h"
+#include <opencv2/highgui.hpp>
+#include <stdexcept>
+#include <algorithm>
+#include "panorama.h"
+#include "batch.h"
+
+using namespace std;
+
+Panorama::Panorama(const std::string& filename)
+{
+	cv::Mat img = cv::imread(filename, cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+	if (!img.data)
+		throw std::runtime_error("read image failed: " + filename);
+	if (img.depth() == CV_8U)
+		img.convertTo(image_, CV_32FC3, 1.0 / 255.0);
+	else
+		img.convertTo(image_, CV_32FC3);
+}
+
+Panorama::Panorama(const cv::Mat& image)
+	:image_(image)
+{
+
+}
+
+Vec3 Panorama::Sample(const Vec3& pos)const
+{
+	Vec3 s = Cartesian2Spherical(pos);
+	int w = Width();
+	int h = Height();
+	int i = min((int)(s.theta / PI * h), h - 1);
+	int j = min((int)((s.phi + PI) / (2 * PI) * w), w - 1);
+	auto c = image_.at<cv::Vec3f>(max(i, 0), max(j, 0));
+	return Vec3{ c[2], c[1], c[0] };
+}
+
+void Panorama::Sample(SampleBatch& samples)const
+{
+	for (size_t i = 0; i < samples.Size(); i++)
+	{
+		Vec3 c = Sample(Vec3(samples.x[i], samples.y[i], samples.z[i]));
+		samples.r[i] = c.r;
+		samples.g[i] = c.g;
+		samples.b[i] = c.b;
+	}
+}
+
+void Panorama::RowColors(int row, float* r, float* g, float* b)const
+{
+	const cv::Vec3f* texels = image_.ptr<cv::Vec3f>(row);
+	for (int j = 0; j < image_.cols; j++)
+	{
+		r[j] = texels[j][2];
+		g[j] = texels[j][1];
+		b[j] = texels[j][0];
+	}
+}
\ No newline at end of file
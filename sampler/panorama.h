@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <opencv2/core.hpp>
+#include "util.h"
+
+class SampleBatch;
+
+// equirectangular (lat-long) environment. row i covers theta in
+// [i pi/h, (i+1) pi/h] from +y down, column j covers phi in
+// [2 pi j/w - pi, 2 pi (j+1)/w - pi], phi as in Cartesian2Spherical
+class Panorama
+{
+public:
+	// 8-bit images are scaled to [0, 1], float images (hdr, exr) are kept
+	explicit Panorama(const std::string& filename);
+	// CV_32FC3 image
+	explicit Panorama(const cv::Mat& image);
+	int Width()const { return image_.cols; }
+	int Height()const { return image_.rows; }
+	size_t TexelNum()const { return (size_t)Width() * Height(); }
+	Vec3 Sample(const Vec3& pos)const;
+	// looks up the colors of the directions already in samples
+	void Sample(SampleBatch& samples)const;
+	// colors of the texels of a row as separate channels
+	void RowColors(int row, float* r, float* g, float* b)const;
+private:
+	cv::Mat image_;
+};
\ No newline at end of file
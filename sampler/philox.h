@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"). every (key, counter) pair maps to its own
+// four random words, so sample i can be drawn on any thread, in any order,
+// with no generator state
+class Philox
+{
+public:
+	typedef std::array<uint32_t, 4> Block;
+
+	explicit Philox(uint64_t seed)
+		:key_{ (uint32_t)seed, (uint32_t)(seed >> 32) }
+	{}
+
+	// random words of sample index, stream separates independent draws
+	// made for the same index
+	Block operator()(uint64_t index, uint32_t stream = 0)const
+	{
+		Block c = { (uint32_t)index, (uint32_t)(index >> 32), stream, 0 };
+		uint32_t k0 = key_[0];
+		uint32_t k1 = key_[1];
+		for (int round = 0; round < 10; round++)
+		{
+			uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+			uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+			c = { (uint32_t)(p1 >> 32) ^ c[1] ^ k0, (uint32_t)p1,
+				(uint32_t)(p0 >> 32) ^ c[3] ^ k1, (uint32_t)p0 };
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+		return c;
+	}
+
+	// maps a random word to [0, 1)
+	static float Uniform(uint32_t u)
+	{
+		return (u >> 8) * (1.f / (1 << 24));
+	}
+
+private:
+	std::array<uint32_t, 2> key_;
+};
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include "result_cache.h"
+#include "coef_pack.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+	const char Magic[] = "sampler-cache 1";
+}
+
+bool FileStamp(const std::string& filename, uint64_t& size, int64_t& mtime)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data))
+		return false;
+	size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+	// 100 ns ticks since 1601
+	mtime = (int64_t)((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32
+		| data.ftLastWriteTime.dwLowDateTime) * 100;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0)
+		return false;
+	size = (uint64_t)st.st_size;
+#ifdef __APPLE__
+	mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+	return true;
+}
+
+ResultCache::ResultCache(const std::string& filename, const std::string& params,
+	const std::vector<std::string>& sources)
+	:filename_(filename), params_(params), sources_(sources), stamps_(sources.size())
+{
+	for (size_t i = 0; i < sources_.size(); i++)
+		stamps_[i].exists = FileStamp(sources_[i], stamps_[i].size, stamps_[i].mtime);
+}
+
+bool ResultCache::Lookup(std::vector<Vec3>& coefs, size_t& samples)
+{
+	ifstream in(filename_);
+	string line;
+	if (!getline(in, line) || line != Magic)
+		return false;
+	if (!getline(in, line) || line != "params " + params_)
+		return false;
+
+	// a source written within a second of the cache may have changed again
+	// without moving its time on a filesystem of coarse timestamps, so its
+	// stamp is not trusted
+	uint64_t cache_size = 0;
+	int64_t written = 0;
+	bool stamps_match = FileStamp(filename_, cache_size, written);
+	for (size_t i = 0; i < sources_.size(); i++)
+	{
+		string word, path;
+		Stamp stored;
+		if (!(in >> word >> stored.size >> stored.mtime) || word != "source")
+			return false;
+		in.get();
+		getline(in, path);
+		if (path != sources_[i] || !stamps_[i].exists)
+			return false;
+		if (stored.size != stamps_[i].size || stored.mtime != stamps_[i].mtime
+			|| stamps_[i].mtime > written - 1000000000)
+			stamps_match = false;
+	}
+
+	string word;
+	uint64_t hash;
+	if (!(in >> word >> hex >> hash >> dec) || word != "hash")
+		return false;
+	size_t count;
+	if (!(in >> word >> samples) || word != "samples")
+		return false;
+	if (!(in >> word >> count) || word != "coefficients")
+		return false;
+	coefs.resize(count);
+	for (Vec3& c : coefs)
+		in >> c.r >> c.g >> c.b;
+	if (!in)
+		return false;
+
+	// touched but unchanged sources cost one read, after which the new times
+	// are recorded so the next lookup reads nothing
+	if (!stamps_match)
+	{
+		if (Hash() != hash)
+			return false;
+		Store(coefs, samples);
+	}
+	hash_ = hash;
+	hashed_ = true;
+	return true;
+}
+
+uint64_t ResultCache::Hash()
+{
+	if (!hashed_)
+	{
+		hash_ = SourceHash(sources_);
+		hashed_ = true;
+	}
+	return hash_;
+}
+
+void ResultCache::Store(const std::vector<Vec3>& coefs, size_t samples)
+{
+	string tmp = filename_ + ".tmp";
+	{
+		ofstream out(tmp);
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+		out << Magic << "\n";
+		out << "params " << params_ << "\n";
+		for (size_t i = 0; i < sources_.size(); i++)
+			out << "source " << stamps_[i].size << " " << stamps_[i].mtime << " " << sources_[i] << "\n";
+		out << "hash " << hex << Hash() << dec << "\n";
+		out << "samples " << samples << "\n";
+		out << "coefficients " << coefs.size() << "\n";
+		out << setprecision(numeric_limits<float>::max_digits10);
+		for (const Vec3& c : coefs)
+			out << c.r << " " << c.g << " " << c.b << "\n";
+		if (!out)
+			throw runtime_error("write " + tmp + " failed");
+	}
+	remove(filename_.c_str());
+	if (rename(tmp.c_str(), filename_.c_str()) != 0)
+		throw runtime_error("rename " + tmp + " failed");
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "util.h"
+
+// size and modification time in nanoseconds of filename, false when it does
+// not exist
+bool FileStamp(const std::string& filename, uint64_t& size, int64_t& mtime);
+
+// coefficients of one environment kept next to it with what they were made
+// from: the sampling parameters and the size, modification time and content
+// hash of the source files. a lookup reads no source file while their sizes
+// and times are unchanged, and hashes them only when those differ
+class ResultCache
+{
+public:
+	// params holds every option that changes the coefficients
+	ResultCache(const std::string& filename, const std::string& params,
+		const std::vector<std::string>& sources);
+	// true when the stored result is still valid, its coefficients and
+	// sample count are returned
+	bool Lookup(std::vector<Vec3>& coefs, size_t& samples);
+	// SourceHash of the sources, read once
+	uint64_t Hash();
+	// replaces the stored result, the sources are described as they were
+	// when the cache was opened
+	void Store(const std::vector<Vec3>& coefs, size_t samples);
+private:
+	struct Stamp
+	{
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		bool exists = false;
+	};
+
+	std::string filename_;
+	std::string params_;
+	std::vector<std::string> sources_;
+	std::vector<Stamp> stamps_;
+	uint64_t hash_ = 0;
+	bool hashed_ = false;
+};
\ No newline at end of file
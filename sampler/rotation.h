@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+
+// rotation of SH coefficients in the layout of SHBasis and SHRecurrence.
+// the band matrices come from the band 1 matrix by the Ivanic-Ruedenberg
+// recurrence, so building them costs O(degree^3) and applying them one
+// small matrix product per band
+class SHRotation
+{
+public:
+	// r is a row-major 3x3 rotation; the coefficients of f become those of
+	// f(r^T p), the environment turned by r
+	SHRotation(int degree, const float r[9])
+		:degree_(degree)
+	{
+		size_t size = 0;
+		for (int l = 0; l <= degree; l++)
+			size += (2 * l + 1)*(2 * l + 1);
+		bands_.resize(size);
+		bands_[0] = 1.f;
+		if (degree < 1)
+			return;
+
+		// with y and z swapped the basis is the usual real SH with z up,
+		// whose band 1 is ordered y, z, x
+		const int axis[3] = { 2, 1, 0 };	// m = -1, 0, 1 as our x, y, z index
+		for (int m = -1; m <= 1; m++)
+			for (int n = -1; n <= 1; n++)
+				Set(1, m, n, r[3 * axis[m + 1] + axis[n + 1]]);
+		for (int l = 2; l <= degree; l++)
+		{
+			for (int m = -l; m <= l; m++)
+			{
+				for (int n = -l; n <= l; n++)
+				{
+					double d = m == 0 ? 1 : 0;
+					double denom = std::abs(n) == l ? 2.0 * l * (2 * l - 1) : (double)(l + n)*(l - n);
+					double u = std::sqrt((l + m)*(l - m) / denom);
+					double v = 0.5 * std::sqrt((1 + d)*(l + std::abs(m) - 1)*(l + std::abs(m)) / denom) * (1 - 2 * d);
+					double w = -0.5 * std::sqrt((l - std::abs(m) - 1)*(l - std::abs(m)) / denom) * (1 - d);
+					double value = 0;
+					if (u != 0)
+						value += u * U(l, m, n);
+					if (v != 0)
+						value += v * V(l, m, n);
+					if (w != 0)
+						value += w * W(l, m, n);
+					Set(l, m, n, (float)value);
+				}
+			}
+		}
+	}
+
+	int Degree()const { return degree_; }
+
+	// entry (m, n) of the band l matrix
+	float operator()(int l, int m, int n)const
+	{
+		return bands_[Offset(l) + (m + l)*(2 * l + 1) + n + l];
+	}
+
+	// rotates count sets of (degree+1)^2 interleaved r, g, b coefficients;
+	// in and out must not overlap
+	void Apply(const float* in, float* out, size_t count = 1)const
+	{
+		const int n = (degree_ + 1)*(degree_ + 1);
+		for (size_t s = 0; s < count; s++, in += 3 * n, out += 3 * n)
+		{
+			for (int l = 0; l <= degree_; l++)
+			{
+				const int size = 2 * l + 1;
+				const float* band = &bands_[Offset(l)];
+				const float* src = in + 3 * l * l;
+				float* dst = out + 3 * l * l;
+				for (int i = 0; i < size; i++)
+				{
+					float r = 0, g = 0, b = 0;
+					for (int j = 0; j < size; j++)
+					{
+						float a = band[i * size + j];
+						r += a * src[3 * j];
+						g += a * src[3 * j + 1];
+						b += a * src[3 * j + 2];
+					}
+					dst[3 * i] = r;
+					dst[3 * i + 1] = g;
+					dst[3 * i + 2] = b;
+				}
+			}
+		}
+	}
+
+private:
+	int degree_;
+	// band l is a (2l+1)^2 row-major block
+	std::vector<float> bands_;
+
+	static size_t Offset(int l)
+	{
+		// sum of (2k+1)^2 for k < l
+		return (size_t)l * (4 * l * l - 1) / 3;
+	}
+
+	void Set(int l, int m, int n, float value)
+	{
+		bands_[Offset(l) + (m + l)*(2 * l + 1) + n + l] = value;
+	}
+
+	double P(int i, int l, int a, int b)const
+	{
+		const SHRotation& R = *this;
+		if (b == l)
+			return R(1, i, 1) * R(l - 1, a, l - 1) - R(1, i, -1) * R(l - 1, a, -l + 1);
+		if (b == -l)
+			return R(1, i, 1) * R(l - 1, a, -l + 1) + R(1, i, -1) * R(l - 1, a, l - 1);
+		return R(1, i, 0) * R(l - 1, a, b);
+	}
+
+	double U(int l, int m, int n)const
+	{
+		return P(0, l, m, n);
+	}
+
+	double V(int l, int m, int n)const
+	{
+		if (m == 0)
+			return P(1, l, 1, n) + P(-1, l, -1, n);
+		if (m > 0)
+			return P(1, l, m - 1, n) * std::sqrt(m == 1 ? 2.0 : 1.0) - (m == 1 ? 0 : P(-1, l, -m + 1, n));
+		return (m == -1 ? 0 : P(1, l, m + 1, n)) + P(-1, l, -m - 1, n) * std::sqrt(m == -1 ? 2.0 : 1.0);
+	}
+
+	double W(int l, int m, int n)const
+	{
+		if (m > 0)
+			return P(1, l, m + 1, n) + P(-1, l, -m - 1, n);
+		return P(1, l, m - 1, n) - P(-1, l, -m + 1, n);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+// a float vector of Pack::Width lanes, using the widest instruction set
+// enabled at compile time (AVX-512, AVX2, SSE2) and plain float otherwise
+
+#if defined(__AVX512F__)
+#define SIMD_AVX512
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#define SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+
+#if defined(SIMD_AVX512)
+
+struct Pack
+{
+	static const int Width = 16;
+	static const char* Name() { return "AVX-512"; }
+	__m512 v;
+	Pack() :v(_mm512_setzero_ps()) {}
+	Pack(float f) :v(_mm512_set1_ps(f)) {}
+	Pack(__m512 v_) :v(v_) {}
+	static Pack Load(const float* p) { return _mm512_loadu_ps(p); }
+	void Store(float* p)const { _mm512_storeu_ps(p, v); }
+};
+inline Pack operator+(Pack a, Pack b) { return _mm512_add_ps(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm512_sub_ps(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm512_mul_ps(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm512_div_ps(a.v, b.v); }
+inline Pack Sqrt(Pack a) { return _mm512_sqrt_ps(a.v); }
+inline float ReduceAdd(Pack a) { return _mm512_reduce_add_ps(a.v); }
+
+#elif defined(SIMD_AVX2)
+
+struct Pack
+{
+	static const int Width = 8;
+	static const char* Name() { return "AVX2"; }
+	__m256 v;
+	Pack() :v(_mm256_setzero_ps()) {}
+	Pack(float f) :v(_mm256_set1_ps(f)) {}
+	Pack(__m256 v_) :v(v_) {}
+	static Pack Load(const float* p) { return _mm256_loadu_ps(p); }
+	void Store(float* p)const { _mm256_storeu_ps(p, v); }
+};
+inline Pack operator+(Pack a, Pack b) { return _mm256_add_ps(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm256_sub_ps(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm256_mul_ps(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm256_div_ps(a.v, b.v); }
+inline Pack Sqrt(Pack a) { return _mm256_sqrt_ps(a.v); }
+inline float ReduceAdd(Pack a)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+#elif defined(SIMD_SSE)
+
+struct Pack
+{
+	static const int Width = 4;
+	static const char* Name() { return "SSE2"; }
+	__m128 v;
+	Pack() :v(_mm_setzero_ps()) {}
+	Pack(float f) :v(_mm_set1_ps(f)) {}
+	Pack(__m128 v_) :v(v_) {}
+	static Pack Load(const float* p) { return _mm_loadu_ps(p); }
+	void Store(float* p)const { _mm_storeu_ps(p, v); }
+};
+inline Pack operator+(Pack a, Pack b) { return _mm_add_ps(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm_sub_ps(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm_mul_ps(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm_div_ps(a.v, b.v); }
+inline Pack Sqrt(Pack a) { return _mm_sqrt_ps(a.v); }
+inline float ReduceAdd(Pack a)
+{
+	__m128 s = _mm_add_ps(a.v, _mm_movehl_ps(a.v, a.v));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+#else
+
+struct Pack
+{
+	static const int Width = 1;
+	static const char* Name() { return "scalar"; }
+	float v;
+	Pack() :v(0) {}
+	Pack(float f) :v(f) {}
+	static Pack Load(const float* p) { return *p; }
+	void Store(float* p)const { *p = v; }
+};
+inline Pack operator+(Pack a, Pack b) { return a.v + b.v; }
+inline Pack operator-(Pack a, Pack b) { return a.v - b.v; }
+inline Pack operator*(Pack a, Pack b) { return a.v * b.v; }
+inline Pack operator/(Pack a, Pack b) { return a.v / b.v; }
+inline Pack Sqrt(Pack a) { return std::sqrt(a.v); }
+inline float ReduceAdd(Pack a) { return a.v; }
+
+#endif
\ No newline at end of file
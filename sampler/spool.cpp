@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include "spool.h"
+#include "result_cache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+SpoolService::SpoolService(const std::string& spool, int workers, Runner run, Sources sources)
+	:spool_(spool), run_(run), sources_(sources)
+{
+	for (int i = 0; i < max(1, workers); i++)
+		workers_.emplace_back(&SpoolService::Work, this);
+}
+
+SpoolService::~SpoolService()
+{
+	{
+		lock_guard<mutex> lock(mutex_);
+		stopping_ = true;
+		// running jobs finish, the queued ones are dropped
+		for (const string& name : queue_)
+		{
+			entries_[name].queued = false;
+			SetStatus(name, "cancelled");
+		}
+		queue_.clear();
+	}
+	wake_.notify_all();
+	for (thread& t : workers_)
+		t.join();
+}
+
+void SpoolService::Run(std::chrono::milliseconds interval)
+{
+	string stop = spool_ + "stop";
+	cout << "watching " << spool_ << ", create " << stop << " to end" << endl;
+	while (!GetStamp(stop).exists)
+	{
+		Scan();
+		this_thread::sleep_for(interval);
+	}
+	remove(stop.c_str());
+}
+
+SpoolService::Stamp SpoolService::GetStamp(const std::string& filename)
+{
+	Stamp stamp;
+	stamp.exists = FileStamp(filename, stamp.size, stamp.mtime);
+	return stamp;
+}
+
+std::vector<std::string> SpoolService::ListJobs(const std::string& dir)
+{
+	const string suffix = ".job";
+	vector<string> files;
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((dir + "*" + suffix).c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return files;
+	do
+		files.push_back(data.cFileName);
+	while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+		throw runtime_error("open " + dir + " failed");
+	while (dirent* e = readdir(d))
+		files.push_back(e->d_name);
+	closedir(d);
+#endif
+	vector<string> names;
+	for (const string& file : files)
+		if (file.size() > suffix.size() && file.compare(file.size() - suffix.size(), suffix.size(), suffix) == 0)
+			names.push_back(file.substr(0, file.size() - suffix.size()));
+	return names;
+}
+
+SpoolService::Job SpoolService::ReadJob(const std::string& filename, const std::string& name)
+{
+	ifstream file(filename);
+	if (!file)
+		throw runtime_error("open " + filename + " failed");
+	Job job;
+	job.name = name;
+	string line;
+	while (getline(file, line))
+	{
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line.empty() || line[0] == '#')
+			continue;
+		size_t end = line.find_first_of(" \t");
+		size_t value = line.find_first_not_of(" \t", end);
+		job.fields[line.substr(0, end)] = value == string::npos ? "" : line.substr(value);
+	}
+	return job;
+}
+
+void SpoolService::Scan()
+{
+	vector<string> names = ListJobs(spool_);
+	sort(names.begin(), names.end());
+	lock_guard<mutex> lock(mutex_);
+
+	// a removed job file cancels its job
+	for (auto it = entries_.begin(); it != entries_.end();)
+	{
+		Entry& entry = it->second;
+		if (entry.removed || binary_search(names.begin(), names.end(), it->first))
+		{
+			++it;
+			continue;
+		}
+		// a job whose file or sources could not be read was never queued
+		if (entry.cancelled)
+			entry.cancelled->store(true);
+		if (entry.queued)
+			queue_.erase(find(queue_.begin(), queue_.end(), it->first));
+		if (entry.running)
+		{
+			entry.removed = true;
+			++it;
+		}
+		else
+		{
+			SetStatus(it->first, "cancelled");
+			it = entries_.erase(it);
+		}
+	}
+
+	// queued jobs read their sources when they run, running ones are
+	// checked again once they finish
+	for (const string& name : names)
+	{
+		auto it = entries_.find(name);
+		if (it != entries_.end() && (it->second.queued || it->second.running))
+			continue;
+		bool added = it == entries_.end();
+		Entry& entry = entries_[name];
+		string job_file = spool_ + name + ".job";
+		Stamp job_stamp = GetStamp(job_file);
+		bool changed = added || !(job_stamp == entry.job_stamp);
+		if (changed)
+		{
+			entry.job_stamp = job_stamp;
+			entry.source_stamps.clear();
+			try {
+				entry.job = ReadJob(job_file, name);
+				entry.sources = sources_(entry.job);
+			}
+			catch (const std::exception& e)
+			{
+				// retried once the job file changes
+				entry.sources.clear();
+				SetStatus(name, string("failed: ") + e.what());
+				continue;
+			}
+		}
+		if (entry.sources.empty())
+			continue;
+
+		vector<Stamp> stamps;
+		for (const string& source : entry.sources)
+			stamps.push_back(GetStamp(source));
+		if (changed || stamps != entry.source_stamps)
+		{
+			entry.source_stamps = stamps;
+			Enqueue(entry);
+		}
+	}
+}
+
+void SpoolService::Enqueue(Entry& entry)
+{
+	entry.queued = true;
+	entry.cancelled = make_shared<atomic<bool>>(false);
+	queue_.push_back(entry.job.name);
+	SetStatus(entry.job.name, "queued");
+	wake_.notify_one();
+}
+
+void SpoolService::Work()
+{
+	unique_lock<mutex> lock(mutex_);
+	while (true)
+	{
+		wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+		if (stopping_)
+			return;
+		string name = queue_.front();
+		queue_.pop_front();
+		Entry& entry = entries_[name];
+		entry.queued = false;
+		entry.running = true;
+		Job job = entry.job;
+		shared_ptr<atomic<bool>> cancelled = entry.cancelled;
+		lock.unlock();
+
+		string status;
+		auto start = chrono::steady_clock::now();
+		try {
+			run_(job, *cancelled, [this, &name](const string& stage) { SetStatus(name, stage); });
+			ostringstream done;
+			done << "done in " << fixed << setprecision(2)
+				<< chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s";
+			status = *cancelled ? "cancelled" : done.str();
+		}
+		catch (const std::exception& e)
+		{
+			// a cancelled run may stop by throwing
+			status = *cancelled ? "cancelled" : string("failed: ") + e.what();
+		}
+		SetStatus(name, status);
+
+		lock.lock();
+		auto it = entries_.find(name);
+		it->second.running = false;
+		if (it->second.removed)
+			entries_.erase(it);
+	}
+}
+
+void SpoolService::SetStatus(const std::string& name, const std::string& status)
+{
+	string filename = spool_ + name + ".status";
+	string tmp = filename + ".tmp";
+	{
+		ofstream out(tmp);
+		out << status << "\n";
+	}
+	remove(filename.c_str());
+	rename(tmp.c_str(), filename.c_str());
+	cout << ("[" + name + "] " + status + "\n") << flush;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+
+// long-running projection service fed by a spool directory. every NAME.job
+// registers one environment as lines of "key value"; the job runs when its
+// file appears or changes, and again whenever one of its source files
+// changes, so a dropped face reprocesses only that environment. removing
+// NAME.job cancels it: a queued run is dropped and a running one is told to
+// stop. the state of every job is kept in NAME.status, and a file named stop
+// ends the service once the running jobs finish, the queued ones are
+// marked cancelled
+class SpoolService
+{
+public:
+	struct Job
+	{
+		std::string name;
+		std::map<std::string, std::string> fields;
+	};
+	typedef std::function<void(const std::string&)> Progress;
+	// processes job, reporting its stages through progress and returning
+	// early or throwing once cancelled is set; throws on failure
+	typedef std::function<void(const Job& job, const std::atomic<bool>& cancelled,
+		const Progress& progress)> Runner;
+	// files whose changes rerun job
+	typedef std::function<std::vector<std::string>(const Job& job)> Sources;
+
+	SpoolService(const std::string& spool, int workers, Runner run, Sources sources);
+	~SpoolService();
+	// scans the spool every interval until it is stopped
+	void Run(std::chrono::milliseconds interval);
+private:
+	SpoolService(const SpoolService&) = delete;
+	void operator=(const SpoolService&) = delete;
+
+	struct Stamp
+	{
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		bool exists = false;
+		bool operator==(const Stamp& s)const
+		{
+			return size == s.size && mtime == s.mtime && exists == s.exists;
+		}
+	};
+
+	struct Entry
+	{
+		Job job;
+		// of the job file and of the sources when the job was last queued
+		Stamp job_stamp;
+		std::vector<std::string> sources;
+		std::vector<Stamp> source_stamps;
+		std::shared_ptr<std::atomic<bool>> cancelled;
+		bool queued = false;
+		bool running = false;
+		// the job file went away while running, dropped when the run ends
+		bool removed = false;
+	};
+
+	static Stamp GetStamp(const std::string& filename);
+	static std::vector<std::string> ListJobs(const std::string& dir);
+	static Job ReadJob(const std::string& filename, const std::string& name);
+	void Scan();
+	void Enqueue(Entry& entry);
+	void Work();
+	void SetStatus(const std::string& name, const std::string& status);
+
+	std::string spool_;
+	Runner run_;
+	Sources sources_;
+	std::map<std::string, Entry> entries_;
+	std::deque<std::string> queue_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool stopping_ = false;
+	std::vector<std::thread> workers_;
+};
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "util.h"
+#include <opencv2/highgui.hpp>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cctype>
+#include "tiled_cubemap.h"
+#include "cubemap.h"
+#include "mapped_file.h"
+
+using namespace std;
+
+// next whitespace separated token of a netpbm header, skipping # comments
+static string HeaderToken(const MappedFile& file, size_t& pos)
+{
+	const char* data = file.Data();
+	while (pos < file.Size())
+	{
+		if (data[pos] == '#')
+		{
+			while (pos < file.Size() && data[pos] != '\n')
+				pos++;
+		}
+		else if (isspace((unsigned char)data[pos]))
+			pos++;
+		else
+			break;
+	}
+	string token;
+	while (pos < file.Size() && !isspace((unsigned char)data[pos]))
+		token += data[pos++];
+	return token;
+}
+
+TiledCubemap::TiledCubemap(std::array<std::string, 6> image_filenames, size_t tile_budget)
+	:tile_budget_(tile_budget)
+{
+	for (int k = 0; k < 6; k++)
+	{
+		Face& face = faces_[k];
+		face.filename = image_filenames[k];
+		cv::Size size = JpegSize(face.filename);
+		if (size.width == 0)
+		{
+			face.file.reset(new MappedFile(face.filename));
+			size_t pos = 0;
+			string magic = HeaderToken(*face.file, pos);
+			if (magic != "P6" && magic != "PF")
+				throw runtime_error("tiled faces must be binary ppm, pfm or jpeg: " + face.filename);
+			size.width = atoi(HeaderToken(*face.file, pos).c_str());
+			size.height = atoi(HeaderToken(*face.file, pos).c_str());
+			string last = HeaderToken(*face.file, pos);
+			size_t texel_bytes;
+			if (magic == "P6")
+			{
+				face.maxval = atoi(last.c_str());
+				if (face.maxval <= 0 || face.maxval > 65535)
+					throw runtime_error("bad ppm maxval: " + face.filename);
+				texel_bytes = face.maxval < 256 ? 3 : 6;
+			}
+			else
+			{
+				// a positive scale marks big-endian floats
+				face.big_endian = atof(last.c_str()) > 0;
+				texel_bytes = 3 * sizeof(float);
+			}
+			// a single whitespace character ends the header
+			pos++;
+			if (size.width <= 0 || size.height <= 0
+				|| face.file->Size() < pos + texel_bytes * size.width * size.height)
+				throw runtime_error("truncated image: " + face.filename);
+			face.pixels = face.file->Data() + pos;
+		}
+		if (k == 0)
+		{
+			width_ = size.width;
+			height_ = size.height;
+		}
+		else if (size.width != width_ || size.height != height_)
+			throw runtime_error("face size mismatch: " + face.filename);
+	}
+}
+
+TiledCubemap::~TiledCubemap()
+{
+
+}
+
+int TiledCubemap::TileRows()const
+{
+	size_t row_bytes = 3 * sizeof(float) * (size_t)width_;
+	return (int)max<size_t>(1, min<size_t>(height_, tile_budget_ / row_bytes));
+}
+
+void TiledCubemap::ReadRow(const Face& face, const cv::Mat& decoded, int width, int height, int row,
+	float* r, float* g, float* b)
+{
+	if (!face.file)
+	{
+		const cv::Vec3b* texels = decoded.ptr<cv::Vec3b>(row);
+		for (int j = 0; j < width; j++)
+		{
+			r[j] = texels[j][2] / 255.f;
+			g[j] = texels[j][1] / 255.f;
+			b[j] = texels[j][0] / 255.f;
+		}
+	}
+	else if (face.maxval == 0)
+	{
+		// pfm rows run bottom to top
+		const char* p = face.pixels + (size_t)(height - 1 - row) * width * 3 * sizeof(float);
+		float* channels[3] = { r, g, b };
+		for (int j = 0; j < width; j++)
+		{
+			for (int c = 0; c < 3; c++, p += sizeof(float))
+			{
+				char bytes[sizeof(float)];
+				memcpy(bytes, p, sizeof(float));
+				if (face.big_endian)
+					reverse(bytes, bytes + sizeof(float));
+				memcpy(&channels[c][j], bytes, sizeof(float));
+			}
+		}
+	}
+	else if (face.maxval < 256)
+	{
+		const unsigned char* p = (const unsigned char*)face.pixels + (size_t)row * width * 3;
+		float scale = 1.f / face.maxval;
+		for (int j = 0; j < width; j++, p += 3)
+		{
+			r[j] = p[0] * scale;
+			g[j] = p[1] * scale;
+			b[j] = p[2] * scale;
+		}
+	}
+	else
+	{
+		// 16-bit samples are big-endian
+		const unsigned char* p = (const unsigned char*)face.pixels + (size_t)row * width * 6;
+		float scale = 1.f / face.maxval;
+		for (int j = 0; j < width; j++, p += 6)
+		{
+			r[j] = (p[0] << 8 | p[1]) * scale;
+			g[j] = (p[2] << 8 | p[3]) * scale;
+			b[j] = (p[4] << 8 | p[5]) * scale;
+		}
+	}
+}
+
+void TiledCubemap::ForEachTile(const std::function<void(const Tile&)>& f, int thread_num)const
+{
+	int w = width_;
+	int tile_rows = TileRows();
+	vector<float> r((size_t)tile_rows * w), g((size_t)tile_rows * w), b((size_t)tile_rows * w);
+	if (thread_num < 1)
+		thread_num = 1;
+	for (int k = 0; k < 6; k++)
+	{
+		const Face& face = faces_[k];
+		// released before the next face is decoded
+		cv::Mat decoded;
+		if (!face.file)
+		{
+			decoded = cv::imread(face.filename, cv::IMREAD_COLOR);
+			if (!decoded.data)
+				throw runtime_error("read image failed: " + face.filename);
+			if (decoded.cols != width_ || decoded.rows != height_)
+				throw runtime_error("face size mismatch: " + face.filename);
+		}
+		for (int first = 0; first < height_; first += tile_rows)
+		{
+			int rows = min(tile_rows, height_ - first);
+			auto convert = [&](int begin, int end) {
+				for (int i = begin; i < end; i++)
+				{
+					size_t offset = (size_t)i * w;
+					ReadRow(face, decoded, w, height_, first + i, &r[offset], &g[offset], &b[offset]);
+				}
+			};
+			int per_thread = (rows + thread_num - 1) / thread_num;
+			vector<thread> workers;
+			for (int t = 1; t < thread_num && t * per_thread < rows; t++)
+				workers.emplace_back(convert, t * per_thread, min(rows, (t + 1) * per_thread));
+			convert(0, min(rows, per_thread));
+			for (thread& worker : workers)
+				worker.join();
+			f(Tile{ k, first, rows, r.data(), g.data(), b.data() });
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <memory>
+#include <functional>
+#include <opencv2/core.hpp>
+#include "util.h"
+
+class MappedFile;
+
+// cubemap read a band of rows at a time, for faces too large to keep
+// resident. binary ppm (P6, 8 or 16 bit) and pfm faces are memory mapped and
+// only the current tile is converted to float; jpeg faces are decoded one at
+// a time, so their peak also holds one decoded 8-bit face
+class TiledCubemap
+{
+public:
+	// float rgb of rows x width texels starting at first_row of face
+	struct Tile
+	{
+		int face;
+		int first_row;
+		int rows;
+		const float* r;
+		const float* g;
+		const float* b;
+	};
+
+	// +x, -x, +y, -y, +z, -z; tile_budget is the bytes of float texels held
+	// at once, at least one row
+	TiledCubemap(std::array<std::string, 6> image_filenames, size_t tile_budget);
+	~TiledCubemap();
+	int Width()const { return width_; }
+	int Height()const { return height_; }
+	size_t TexelNum()const { return 6 * (size_t)width_ * height_; }
+	int TileRows()const;
+	// calls f for every tile in face and row order, rows of a tile are
+	// converted by thread_num threads
+	void ForEachTile(const std::function<void(const Tile&)>& f, int thread_num = 1)const;
+private:
+	TiledCubemap(const TiledCubemap&) = delete;
+	void operator=(const TiledCubemap&) = delete;
+
+	// a mapped face, or a jpeg when file is null
+	struct Face
+	{
+		std::string filename;
+		std::unique_ptr<MappedFile> file;
+		const char* pixels = nullptr;
+		// P6 maxval, 0 for pfm
+		int maxval = 0;
+		bool big_endian = false;
+	};
+
+	// float rgb of one row of face, decoded holds the face when it is a jpeg
+	static void ReadRow(const Face& face, const cv::Mat& decoded, int width, int height, int row,
+		float* r, float* g, float* b);
+
+	std::array<Face, 6> faces_;
+	int width_ = 0;
+	int height_ = 0;
+	size_t tile_budget_;
+};
\ No newline at end of file
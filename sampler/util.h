@@ -26,6 +26,11 @@ inline Vec3 operator+(const Vec3& a, const Vec3& b)
 	return Vec3(a.x+b.x, a.y+b.y, a.z+b.z);
 }
 
+inline Vec3 operator-(const Vec3& a, const Vec3& b)
+{
+	return Vec3(a.x-b.x, a.y-b.y, a.z-b.z);
+}
+
 inline Vec3 operator*(float c, const Vec3& a)
 {
 	return Vec3(c*a.x, c*a.y, c*a.z);
@@ -111,16 +116,17 @@ inline CubeUV XYZ2CubeUV(const Vec3& p)
 	return c;
 }
 
+// per-thread engines, see Philox for reproducible parallel sampling
 inline float UniformRandom()
 {
-	static std::default_random_engine generator;
-	static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	thread_local std::default_random_engine generator;
+	thread_local std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
 	return distribution(generator);
 }
 
 inline float NormalRandom(float mu = 0.f, float sigma = 1.f)
 {
-	static std::default_random_engine generator;
-	static std::normal_distribution<float> distribution(mu, sigma);
+	thread_local std::default_random_engine generator;
+	thread_local std::normal_distribution<float> distribution(mu, sigma);
 	return distribution(generator);
 }
\ No newline at end of file